@@ -11,24 +11,144 @@
 #ifdef TARGET_LINUX
 #include <ctype.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
 #else
 int isalpha(int c);
 int isdigit(int c);
 int toupper(int c);
 #endif
 
+#include "muldiv.h"
+
+
+#ifndef MAX_PROG
+#define MAX_PROG 1024             // program[] bytes
+#endif
 
-#define MAX_PROG 1024
 #define MAX_LINE 64
 #define NUM_VARS 26
 
-void print(uint8_t len, uint8_t *str);
+#ifndef MAX_CODE
+#define MAX_CODE (MAX_PROG * 2)   // compiled image size, 0 to disable
+#endif
+
+#define EVAL_STACK 16
+
+#ifndef EXPR_DEPTH
+#define EXPR_DEPTH 16             // nested parentheses, LEN and MID$
+#endif
+
+// Statements and compiled expressions are dispatched through a switch or,
+// when built with THREADED_DISPATCH on GCC, through a table of label
+// addresses indexed by token.
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+#define THREADED
+#define DISPATCH(table, tok) goto *table[tok];
+#define OP(tok)              op_##tok:
+#define OP_DEFAULT           op_default:
+#else
+#define DISPATCH(table, tok) switch (tok)
+#define OP(tok)              case tok:
+#define OP_DEFAULT           default:
+#endif
+
+// Keeps a rarely used function with a large frame out of its callers, so
+// that frame is only on the stack while it runs
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+#ifndef FOR_DEPTH
+#define FOR_DEPTH 8               // nested FOR loops
+#endif
+
+#ifndef GOSUB_DEPTH
+#define GOSUB_DEPTH 8             // nested GOSUB calls
+#endif
+
+#ifndef MAX_TASKS
+#define MAX_TASKS 4               // task 0 (RUN) plus those started by TASK, 1 to disable
+#endif
+
+#ifndef TASK_SLICE
+#define TASK_SLICE 16             // statements a task runs before the next
+#endif
+
+#ifndef ARRAY_CELLS
+#define ARRAY_CELLS 1024          // int16_t cells shared by DIM arrays, 0 to disable
+#endif
+
+#ifndef STRING_ARENA
+#define STRING_ARENA 1024         // bytes for A$ to Z$, 0 to disable
+#endif
+
+#ifndef STRING_TEMPS
+#define STRING_TEMPS 8            // temporaries in a string expression
+#endif
+
+#ifndef OUT_BUF
+#define OUT_BUF 64                // output buffered before hw_write(), 0 for none
+#endif
+
+#ifndef MAX_LINES
+#define MAX_LINES (MAX_PROG / 4)  // shortest line: header, a token, TOK_EOL; 0 for no index
+#endif
+
+#ifndef GOTO_CACHE
+#define GOTO_CACHE 16             // a power of two, 0 to disable
+#endif
+
+#ifndef IF_CACHE
+#define IF_CACHE 16               // a power of two, 0 to disable
+#endif
+
+#ifndef LINE_CACHE
+#define LINE_CACHE 0              // line slots for RUN name, 0 to disable
+#endif
+
+#ifndef CACHE_LINE
+#define CACHE_LINE (LINE_HEADER + MAX_LINE * 2 + 1)   // bytes per slot
+#endif
+
+// RUN's compiler, RUN name and the profiler number lines by the index
+#if !MAX_LINES && (MAX_CODE || LINE_CACHE || defined(BASIC_PROFILE))
+#error "MAX_CODE, LINE_CACHE and BASIC_PROFILE need MAX_LINES"
+#endif
+
+// Line layout: [line# low] [line# high] [tokens...] [TOK_EOL]. A line's
+// size is found by walking its tokens (see line_end()).
+#define LINE_HEADER  2
+#define LINE_NUM(p)  ((p)[0] | ((p)[1] << 8))
+#define LINE_SIZE(p) (line_end((p) + LINE_HEADER) - (p))
+
+// SAVE appends IMAGE_TAG and IMAGE_VERSION to the program. An image
+// without them is from before the current token format and is upgraded
+// by LOAD; it ends with TOK_EOL, which IMAGE_VERSION can never be.
+// Version 2 images differ only in never holding TOK_DIVC, so they are
+// read as they are.
+#define IMAGE_TAG     'B'
+#define IMAGE_VERSION 3
+#define IMAGE_OLDEST  2
+#define IMAGE_OK(v)   ((v) >= IMAGE_OLDEST && (v) <= IMAGE_VERSION)
+#define IMAGE_TRAILER 2
+
+struct basic_ctx;   // one interpreter's state (see INTERPRETER STATE)
+
+void print(struct basic_ctx *ctx, uint8_t len, uint8_t *str);
+
+void hw_write(const uint8_t *data, uint16_t len);
 
-void hw_sleep(uint16_t secs);
 uint8_t hw_peek(uint8_t addr);
 void hw_poke(uint8_t addr, uint8_t val);
 int hw_save(const char *filename, uint8_t *data, uint16_t len);
 int hw_load(const char *filename, uint8_t *data, uint16_t *len, uint16_t max_len);
+uint32_t hw_ticks(void);    // free-running microsecond counter
 
 enum {
     TOK_EOL = 0,
@@ -36,8 +156,8 @@ enum {
     TOK_PRINT,
     TOK_GOTO,
     TOK_END,
-    TOK_VAR,
-    TOK_NUM,
+    TOK_BYTE,       // number 0-255: value (1 byte)
+    TOK_NUM,        // any other number: value (2 bytes)
     TOK_PLUS,
     TOK_MINUS,
     TOK_MUL,
@@ -59,38 +179,436 @@ enum {
     TOK_SLEEP,
     TOK_LPAREN,
     TOK_RPAREN,
-    TOK_COMMA
+    TOK_COMMA,
+    TOK_FOR,
+    TOK_TO,
+    TOK_STEP,
+    TOK_NEXT,
+    TOK_GOSUB,
+    TOK_RETURN,
+    TOK_DIM,
+    TOK_HIBERNATE,
+    TOK_TASK,
+    TOK_SVAR,       // string variable: index (1 byte)
+    TOK_LEN,
+    TOK_MID,
+    TOK_FRE,
+    TOK_VAR,        // variable A; B to Z follow, one token each
+    TOK_VAR_Z = TOK_VAR + NUM_VARS - 1,
+
+    // compiled image only
+    TOK_LOAD,       // variable: index (1 byte)
+    TOK_JMP,        // GOTO with a resolved target: line ordinal (2 bytes)
+    TOK_CALL,       // GOSUB with a resolved target: line ordinal (2 bytes)
+    TOK_INDEX,      // array element: array (1 byte), index on the stack
+    TOK_DIVC,       // division by a constant: multiplier (2 bytes), shift
+    TOK_EXPR_END    // end of a postfix expression
 };
 
-static uint8_t program[MAX_PROG];
-static uint16_t prog_len;
-static int16_t vars[NUM_VARS];
+#define IS_VAR(t) ((uint8_t)((t) - TOK_VAR) < NUM_VARS)
 
 /* Input routing state */
 typedef enum {
     INPUT_MODE_COMMAND,           // Normal command interface
-    INPUT_MODE_AWAITING_INPUT     // Program is waiting for INPUT statement
+    INPUT_MODE_AWAITING_INPUT,    // Program is waiting for INPUT statement
+    INPUT_MODE_SLEEPING,          // Program is waiting out a SLEEP
+    INPUT_MODE_RUNNING            // Program used up its slice (see basic_step())
 } input_mode_t;
 
-static input_mode_t current_input_mode = INPUT_MODE_COMMAND;
-static uint8_t *execution_pc = NULL;  // Saved program counter during INPUT
+static int16_t expr(struct basic_ctx *ctx, uint8_t **pc);
+static int fold_constants(uint8_t *line, int len);
+static int lower_divisions(uint8_t *line, int len);
+// Where to carry on within the exec store: a line, a token in it, and
+// the end of the clause the token sits in (see run_from()). With ip NULL,
+// the start of the line. A program run from a file also notes the line's
+// offset once the cache slot it points into is reused (see LINE CACHE).
+struct resume {
+    uint8_t *pc;
+    uint8_t *ip;
+    uint8_t *end;
+    uint8_t in_if;
+#if LINE_CACHE
+    uint16_t pos;       // offset + 1 in the file, 0 while in its slot
+#endif
+};
 
-static int16_t expr(uint8_t **pc);
-static void run_from(uint8_t *start_pc);
+static void run_from(struct basic_ctx *ctx, const struct resume *at);
 
 /* ================= INPUT ROUTING ================= */
 
+// Targets call the basic_* entry points, which drive a default
+// interpreter. Each has a basic_ctx_* twin taking the interpreter to
+// drive, for hosts running several; basic_ctx_init() prepares one.
+void basic_ctx_init(struct basic_ctx *ctx);
+
 // Main entry point from ls10.c - routes based on current mode
 void basic_yield(uint8_t *line);
+void basic_ctx_yield(struct basic_ctx *ctx, uint8_t *line);
+
+// Called from the target's main loop: resumes a program whose SLEEP is over
+void basic_poll(void);
+void basic_ctx_poll(struct basic_ctx *ctx);
+
+// Called when the target receives a break byte (Ctrl-C)
+void basic_break(void);
+void basic_ctx_break(struct basic_ctx *ctx);
+
+// Run the program for at most max_statements statements and max_us
+// microseconds (0 for no limit), then return one of the BASIC_* states.
+// The limits also apply to programs later started by RUN, resumed by INPUT
+// or woken from SLEEP, so a target calling this from its main loop never
+// hands the interpreter more than one slice at a time.
+enum {
+    BASIC_ENDED,        // nothing to run
+    BASIC_RUNNING,      // call basic_step() again to carry on
+    BASIC_INPUT,        // waiting for a line for INPUT
+    BASIC_SLEEPING      // waiting out a SLEEP
+};
+
+int basic_step(uint32_t max_statements, uint32_t max_us);
+int basic_ctx_step(struct basic_ctx *ctx, uint32_t max_statements,
+                   uint32_t max_us);
+
+/* ================= STATISTICS ================= */
+
+// Cheap counters kept in every build. STATS prints them, STATS RESET
+// clears them, and a program can read counter n with PEEK(STATS_PEEK + n),
+// saturated to 32767.
+#define STATS_PEEK 0xF0
+
+enum {
+    STAT_STATEMENTS,    // statements executed
+    STAT_LINES_RUN,     // program lines executed
+    STAT_LINES_ENTERED, // lines stored or deleted at the prompt
+    STAT_FIND_LINE,     // find_line() calls
+    STAT_SCANNED,       // bytes walked by linear line searches
+    STAT_MAX_DEPTH,     // deepest expression nesting or compiled stack
+    STAT_PEEKS,         // hw_peek() calls
+    STAT_POKES,         // hw_poke() calls
+    STAT_PRINTED,       // bytes passed to hw_write()
+    STAT_SAVE_US,       // duration of the last SAVE
+    STAT_LOAD_US,       // duration of the last LOAD
+    STAT_STRING_PEAK,   // most bytes held by strings at once
+    STAT_STRING_GCS,    // string arena compactions
+    STAT_STACK_MAX,     // deepest C stack below the entry point, bytes
+    STAT_CACHE_HITS,    // lines of a file program found in the line cache
+    STAT_CACHE_MISSES,  // and read from F-RAM
+    NUM_STATS
+};
+
+/* ================= INTERPRETER STATE ================= */
+
+// Everything an interpreter instance owns lives in a struct basic_ctx, so
+// one process can run several programs at once. Every function below
+// takes the context it works on; the basic_* entry points use a default
+// one and the basic_ctx_* ones take it from the caller.
+#define NO_LINE 0xFFFF
+
+// An offset or a count of cells in the DIM arena, a byte when that is
+// enough
+#if ARRAY_CELLS < 256
+typedef uint8_t cell_t;
+#else
+typedef uint16_t cell_t;
+#endif
+
+// Active FOR loops, innermost last. Each keeps a direct pointer to the
+// statement after its FOR, so NEXT jumps back without a line lookup.
+struct for_loop {
+    uint8_t var;
+    int16_t limit;
+    int16_t step;
+    struct resume body;
+};
+
+// A task's own position and stacks (see TASKS)
+struct task {
+    uint8_t state;
+    uint8_t for_sp;
+    uint8_t gosub_sp;
+    uint16_t sleep_secs;    // whole seconds left, counted from sleep_mark
+    uint32_t sleep_mark;
+    struct resume at;       // where it carries on while not current
+    struct for_loop fors[FOR_DEPTH];
+    struct resume gosubs[GOSUB_DEPTH];
+};
+
+struct basic_ctx {
+    // Where output and POKEs go: the target's hw_write() and hw_poke()
+    // unless write and poke are set
+    void (*write)(void *user, const uint8_t *data, uint16_t len);
+    void (*poke)(void *user, uint8_t addr, uint8_t val);
+    void *user;
+
+    uint8_t program[MAX_PROG + IMAGE_TRAILER];
+    uint16_t prog_len;
+    int16_t vars[NUM_VARS];
+
+    input_mode_t current_input_mode;
+    uint8_t *execution_pc;          // Saved program counter during INPUT
+    uint8_t current_input_var;
+#ifdef TARGET_LINUX
+    uint8_t batch_mode;             // -f: no prompts, buffered output
+#endif
+
+    uint32_t stats[NUM_STATS];
+
+#if OUT_BUF
+    uint8_t out_buf[OUT_BUF];
+    uint16_t out_len;
+#endif
+
+#if ARRAY_CELLS
+    // DIM arrays
+    int16_t arena[ARRAY_CELLS];
+    uint16_t arena_top;
+    struct {
+        cell_t base;
+        cell_t size;                // cells, 0 if not dimensioned
+    } arrays[NUM_VARS];
+#endif
+
+#if STRING_ARENA
+    // String variables, then the temporaries of the string expression
+    // being evaluated (see STRINGS)
+    uint8_t str_arena[STRING_ARENA];
+    uint16_t str_top;
+    uint16_t str_used;              // bytes held by live strings
+    struct {
+        uint16_t off;
+        uint8_t len;
+    } strs[NUM_VARS + STRING_TEMPS];
+    uint8_t str_sp;                 // temporaries in use
+#endif
+
+    const char *fault;              // error raised during a statement, if any
+    uint8_t expr_depth;
+    uintptr_t stack_base;           // C stack at the entry point
+
+    // Line index of program[] and the store the running program executes
+    // from: program[] itself, or the compiled image built by RUN. Both use
+    // the same line layout.
+#if MAX_LINES
+    uint16_t line_index[MAX_LINES];
+#endif
+    uint16_t line_count;
+    uint8_t index_ok;
+    uint8_t *exec_base;
+    uint16_t exec_len;
+    uint16_t *exec_index;
+
+#if LINE_CACHE
+    // A program run from a file: its lines are read into the slots as
+    // execution reaches them (see LINE CACHE)
+    uint8_t cache[LINE_CACHE][CACHE_LINE];
+    struct {
+        uint16_t pos;       // offset + 1 of the line in the file, 0 if empty
+        uint8_t len;
+        uint32_t used;      // cache_clock when last used
+    } cache_tag[LINE_CACHE];
+    uint32_t cache_clock;
+    uint8_t *cache_pin;             // the line being run, never replaced
+    uint32_t file_addr;             // F-RAM address of the file's lines
+    uint16_t file_len;
+    uint16_t file_stride;           // lines per line_index[] entry
+#endif
+
+#if GOTO_CACHE
+    struct {
+        uint16_t line;
+        uint16_t pos;       // offset + 1 in the exec store, 0 when empty
+    } goto_cache[GOTO_CACHE];
+#endif
+
+#if IF_CACHE
+    struct {
+        uint16_t pos;       // offset + 1 of the IF, 0 when the slot is empty
+        uint8_t else_off;   // ELSE (or TOK_EOL) relative to the IF
+    } if_cache[IF_CACHE];
+#endif
+
+    // program[] gap buffer
+    uint16_t gap_start;             // == prog_len when closed
+    uint16_t gap_end;
+    uint16_t gap_prev;              // offset of the last line before the gap
+
+#ifdef BASIC_PROFILE
+    struct {
+        uint32_t count;     // times the line was entered
+        uint32_t ticks;     // time spent in it
+        uint32_t gotos;     // times it was a GOTO target
+    } prof[MAX_LINES];
+    uint16_t prof_cur;              // ordinal of the line being timed
+    uint32_t prof_start;
+#endif
+
+#if MAX_CODE
+    uint8_t code[MAX_CODE];
+    uint16_t code_index[MAX_LINES];
+    uint8_t *cp;                    // compiler output position
+    uint8_t c_depth;                // evaluation stack depth at cp
+    uint8_t c_fail;
+#endif
+
+    // Tasks, and the current one's stacks; gosub_stack holds the
+    // statement after each active GOSUB
+    struct task tasks[MAX_TASKS];
+    uint8_t cur_task;
+    uint8_t tasks_ready;            // READY tasks, the current one included
+    uint8_t tasks_sleeping;
+    struct for_loop *for_stack;
+    uint8_t for_sp;
+    struct resume *gosub_stack;
+    uint8_t gosub_sp;
+
+    // Execution slices (see basic_step())
+    uint32_t slice_max;             // statements per slice, 0 for no limit
+    uint32_t slice_us;              // microseconds per slice, 0 for no limit
+    uint32_t slice_left;            // statements before the next check
+    uint32_t slice_quota;           // statements of the slice after those
+    uint32_t slice_deadline;
+    struct resume step_at;          // where a program that ran out carries on
+    uint8_t task_switch;            // slice_over() ended a task's turn
+    uint8_t task_turn;              // statements up to the check are a turn
+
+#ifdef HIBERNATE_ADDR
+    uint16_t snap_pos;              // offset in the snapshot body
+    uint16_t snap_sum;
+    uint8_t snap_fail;              // body does not fit or ends early
+#endif
+};
+
+/* ================= OUTPUT ================= */
+
+// Output is collected in out_buf and handed to the target's hw_write(),
+// or the context's write hook, in one piece: when the buffer fills,
+// before anything that may wait (INPUT, SLEEP) or print on its own (the
+// other hw_* hooks), and at the end of every command line, which includes
+// a program stopping at END. With OUT_BUF=0 every character is handed
+// over as it is printed.
+
+static void out_write(struct basic_ctx *ctx, const uint8_t *data,
+                      uint16_t len) {
+    ctx->stats[STAT_PRINTED] += len;
+    if (ctx->write) ctx->write(ctx->user, data, len);
+    else hw_write(data, len);
+}
+
+#if OUT_BUF
+static void out_flush(struct basic_ctx *ctx) {
+    if (ctx->out_len) {
+        out_write(ctx, ctx->out_buf, ctx->out_len);
+        ctx->out_len = 0;
+    }
+}
+
+static void out_char(struct basic_ctx *ctx, char c) {
+    if (ctx->out_len == OUT_BUF) out_flush(ctx);
+    ctx->out_buf[ctx->out_len++] = c;
+}
+#else
+static void out_flush(struct basic_ctx *ctx) {
+    (void)ctx;
+}
+
+static void out_char(struct basic_ctx *ctx, char c) {
+    uint8_t b = c;
+    out_write(ctx, &b, 1);
+}
+#endif
+
+static void out_bytes(struct basic_ctx *ctx, const uint8_t *p, uint16_t len) {
+    while (len--) out_char(ctx, *p++);
+}
+
+static void out_str(struct basic_ctx *ctx, const char *s) {
+    while (*s) out_char(ctx, *s++);
+}
+
+static void out_uint(struct basic_ctx *ctx, uint32_t v) {
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) out_char(ctx, digits[--n]);
+}
+
+static void out_int(struct basic_ctx *ctx, int16_t v) {
+    if (v < 0) {
+        out_char(ctx, '-');
+        out_uint(ctx, -(int32_t)v);
+    } else {
+        out_uint(ctx, v);
+    }
+}
+
+// Right-aligned in a field of width characters
+static void out_column(struct basic_ctx *ctx, uint32_t v, uint8_t width) {
+    uint8_t digits = 1;
+    for (uint32_t t = v; t >= 10; t /= 10) digits++;
+    while (width-- > digits) out_char(ctx, ' ');
+    out_uint(ctx, v);
+}
+
+// PEEK, with the statistics counters mapped at STATS_PEEK. They fill
+// the window up to 0xFF, so every address from there up is a counter.
+_Static_assert(STATS_PEEK + NUM_STATS == 0x100,
+               "statistics counters must fill the PEEK window");
+
+static int16_t peek(struct basic_ctx *ctx, uint8_t addr) {
+    if (addr >= STATS_PEEK) {
+        uint32_t v = ctx->stats[addr - STATS_PEEK];
+        return v > 32767 ? 32767 : v;
+    }
+    ctx->stats[STAT_PEEKS]++;
+    out_flush(ctx);
+    return hw_peek(addr);
+}
 
 /* ================= TOKENIZER ================= */
 
+// Stored lines are kept small: a variable is a single token, a number
+// from 0 to 255 takes two bytes and any other three.
+static int tok_size(const uint8_t *p) {
+    switch (*p) {
+        case TOK_BYTE: case TOK_SVAR: case TOK_LOAD: case TOK_INDEX:
+            return 2;
+        case TOK_NUM: case TOK_JMP: case TOK_CALL:
+            return 3;
+        case TOK_DIVC: return 4;
+        case TOK_STR: return 2 + p[1];
+    }
+    return 1;
+}
+
+// Just past the TOK_EOL ending the line, from any token in it
+static uint8_t *line_end(uint8_t *ip) {
+    while (*ip != TOK_EOL) ip += tok_size(ip);
+    return ip + 1;
+}
+
+static int is_num(const uint8_t *p) {
+    return *p == TOK_NUM || *p == TOK_BYTE;
+}
+
+static int16_t num_at(const uint8_t *p) {
+    return *p == TOK_BYTE ? p[1] : p[1] | (p[2] << 8);
+}
+
 static uint8_t *emit(uint8_t *p, uint8_t v) {
     *p++ = v;
     return p;
 }
 
 static uint8_t *emit_num(uint8_t *p, int16_t v) {
+    if (v >= 0 && v <= 255) {
+        *p++ = TOK_BYTE;
+        *p++ = v;
+        return p;
+    }
     *p++ = TOK_NUM;
     *p++ = v & 0xFF;
     *p++ = v >> 8;
@@ -104,11 +622,84 @@ static uint8_t *emit_str(uint8_t *p, char *str, int len) {
     return p + len;
 }
 
+// Keywords and operators, shared by the tokenizer and LIST. Sorted by
+// first character, so the entries sharing one form a bucket that a lookup
+// finds by binary search and then compares alone; where one spelling is a
+// prefix of another the longer comes first. Matching is by prefix, as
+// LETTER reads as LET TER.
+#define KW_SPACE_BEFORE 1   // LIST spacing
+#define KW_SPACE_AFTER  2
+
+static const struct keyword {
+    char name[10];
+    uint8_t tok;
+    uint8_t flags;
+} keywords[] = {
+    { "(",      TOK_LPAREN, 0 },
+    { ")",      TOK_RPAREN, 0 },
+    { "*",      TOK_MUL,    KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "+",      TOK_PLUS,   KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { ",",      TOK_COMMA,  KW_SPACE_AFTER },
+    { "-",      TOK_MINUS,  KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "/",      TOK_DIV,    KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "<=",     TOK_LE,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "<>",     TOK_NE,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "<",      TOK_LT,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "==",     TOK_EQEQ,   KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "=",      TOK_EQ,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { ">=",     TOK_GE,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { ">",      TOK_GT,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "DIM",    TOK_DIM,    KW_SPACE_AFTER },
+    { "ELSE",   TOK_ELSE,   KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "END",    TOK_END,    0 },
+    { "FOR",    TOK_FOR,    KW_SPACE_AFTER },
+    { "FRE",    TOK_FRE,    0 },
+    { "GOSUB",  TOK_GOSUB,  KW_SPACE_AFTER },
+    { "GOTO",   TOK_GOTO,   KW_SPACE_AFTER },
+    { "HIBERNATE", TOK_HIBERNATE, 0 },
+    { "IF",     TOK_IF,     KW_SPACE_AFTER },
+    { "INPUT",  TOK_INPUT,  KW_SPACE_AFTER },
+    { "LEN",    TOK_LEN,    0 },
+    { "LET",    TOK_LET,    KW_SPACE_AFTER },
+    { "MID$",   TOK_MID,    0 },
+    { "NEXT",   TOK_NEXT,   KW_SPACE_AFTER },
+    { "PEEK",   TOK_PEEK,   0 },
+    { "POKE",   TOK_POKE,   KW_SPACE_AFTER },
+    { "PRINT",  TOK_PRINT,  KW_SPACE_AFTER },
+    { "RETURN", TOK_RETURN, 0 },
+    { "SLEEP",  TOK_SLEEP,  KW_SPACE_AFTER },
+    { "STEP",   TOK_STEP,   KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "TASK",   TOK_TASK,   KW_SPACE_AFTER },
+    { "THEN",   TOK_THEN,   KW_SPACE_BEFORE | KW_SPACE_AFTER },
+    { "TO",     TOK_TO,     KW_SPACE_BEFORE | KW_SPACE_AFTER },
+};
+
+#define NUM_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
+
+static const struct keyword *find_keyword(const char *src) {
+    // First entry of the bucket for *src
+    uint8_t lo = 0, hi = NUM_KEYWORDS;
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (keywords[mid].name[0] < *src) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (const struct keyword *k = keywords + lo;
+         k < keywords + NUM_KEYWORDS && k->name[0] == *src; k++) {
+        if (!strncmp(src, k->name, strlen(k->name))) return k;
+    }
+    return NULL;
+}
+
 static int tokenize(char *src, uint8_t *out) {
     uint8_t *p = out;
 
     while (*src) {
         while (*src == ' ') src++;
+        if (!*src) break;
+
+        const struct keyword *k;
 
         if (*src == '"') {
             src++;
@@ -127,509 +718,2907 @@ static int tokenize(char *src, uint8_t *out) {
                 v = v * 10 + (*src++ - '0');
             p = emit_num(p, v);
         }
+        else if ((k = find_keyword(src))) {
+            p = emit(p, k->tok);
+            src += strlen(k->name);
+        }
+        else if (isalpha(*src) && src[1] == '$') {
+            p = emit(p, TOK_SVAR);
+            p = emit(p, toupper(*src) - 'A');
+            src += 2;
+        }
         else if (isalpha(*src)) {
-            if (!strncmp(src, "PRINT", 5)) {
-                p = emit(p, TOK_PRINT);
-                src += 5;
-            } else if (!strncmp(src, "INPUT", 5)) {
-                p = emit(p, TOK_INPUT);
-                src += 5;
-            } else if (!strncmp(src, "SLEEP", 5)) {
-                p = emit(p, TOK_SLEEP);
-                src += 5;
-            } else if (!strncmp(src, "THEN", 4)) {
-                p = emit(p, TOK_THEN);
-                src += 4;
-            } else if (!strncmp(src, "ELSE", 4)) {
-                p = emit(p, TOK_ELSE);
-                src += 4;
-            } else if (!strncmp(src, "GOTO", 4)) {
-                p = emit(p, TOK_GOTO);
-                src += 4;
-            } else if (!strncmp(src, "PEEK", 4)) {
-                p = emit(p, TOK_PEEK);
-                src += 4;
-            } else if (!strncmp(src, "POKE", 4)) {
-                p = emit(p, TOK_POKE);
-                src += 4;
-            } else if (!strncmp(src, "LET", 3)) {
-                p = emit(p, TOK_LET);
-                src += 3;
-            } else if (!strncmp(src, "END", 3)) {
-                p = emit(p, TOK_END);
-                src += 3;
-            } else if (!strncmp(src, "IF", 2)) {
-                p = emit(p, TOK_IF);
-                src += 2;
-            } else {
-                p = emit(p, TOK_VAR);
-                p = emit(p, toupper(*src++) - 'A');
-            }
+            p = emit(p, TOK_VAR + toupper(*src++) - 'A');
         }
         else {
-            if (*src == '<' && src[1] == '=') {
-                p = emit(p, TOK_LE);
-                src += 2;
-            } else if (*src == '>' && src[1] == '=') {
-                p = emit(p, TOK_GE);
-                src += 2;
-            } else if (*src == '<' && src[1] == '>') {
-                p = emit(p, TOK_NE);
-                src += 2;
-            } else if (*src == '=' && src[1] == '=') {
-                p = emit(p, TOK_EQEQ);
-                src += 2;
-            } else {
-                switch (*src++) {
-                    case '+': p = emit(p, TOK_PLUS); break;
-                    case '-': p = emit(p, TOK_MINUS); break;
-                    case '*': p = emit(p, TOK_MUL); break;
-                    case '/': p = emit(p, TOK_DIV); break;
-                    case '=': p = emit(p, TOK_EQ); break;
-                    case '<': p = emit(p, TOK_LT); break;
-                    case '>': p = emit(p, TOK_GT); break;
-                    case '(': p = emit(p, TOK_LPAREN); break;
-                    case ')': p = emit(p, TOK_RPAREN); break;
-                    case ',': p = emit(p, TOK_COMMA); break;
-                }
-            }
+            // Unknown character, skip it
+            src++;
         }
     }
 
     *p++ = TOK_EOL;
-    return p - out;
+    return lower_divisions(out, fold_constants(out, p - out));
 }
 
-/* ================= EXPRESSIONS ================= */
+/* ================= CONSTANT FOLDING ================= */
 
-static int16_t factor(uint8_t **pc) {
-    int16_t v = 0;
+// Collapses constant-only subexpressions of a tokenized line into a single
+// number. Only rewrites that expr() would evaluate identically are made:
+// a leading run of constant factors in a term, a leading run of constant
+// terms in an expression, and a parenthesized lone constant. Arithmetic is
+// done in int16_t with the same operators (and division by zero skipped) as
+// term() and expr().
 
-    if (**pc == TOK_NUM) {
-        (*pc)++;
-        v = (*pc)[0] | ((*pc)[1] << 8);
-        *pc += 2;
-    }
-    else if (**pc == TOK_VAR) {
-        (*pc)++;
-        v = vars[*(*pc)++];
-    }
-    else if (**pc == TOK_STR) {
-        (*pc)++;
-        uint8_t len = *(*pc)++;
-        *pc += len;
-        v = 0;
-    }
-    else if (**pc == TOK_PEEK) {
-        (*pc)++;
-        if (**pc == TOK_LPAREN) (*pc)++;
-        int16_t addr = expr(pc);
-        if (**pc == TOK_RPAREN) (*pc)++;
-        v = hw_peek(addr & 0xff);
+// Does an expression begin after this token (within statement stmt)?
+static int expr_start(uint8_t prev, uint8_t stmt) {
+    switch (prev) {
+        case TOK_PRINT: case TOK_GOTO: case TOK_GOSUB:
+        case TOK_POKE: case TOK_SLEEP: case TOK_TASK:
+        case TOK_IF: case TOK_LPAREN: case TOK_TO: case TOK_STEP:
+        case TOK_EQ: case TOK_EQEQ: case TOK_NE:
+        case TOK_LT: case TOK_GT: case TOK_LE: case TOK_GE:
+            return 1;
+        case TOK_COMMA:
+            return stmt == TOK_POKE || stmt == TOK_TASK;
     }
-    else if (**pc == TOK_LPAREN) {
-        (*pc)++;
-        v = expr(pc);
-        if (**pc == TOK_RPAREN) (*pc)++;
+    return 0;
+}
+
+// Replace the bytes from p to rest with a number, returning the new line
+// length
+static int fold_replace(uint8_t *p, uint8_t *rest, int16_t v, uint8_t *line,
+                        int len) {
+    uint8_t num[3];
+    int n = emit_num(num, v) - num;
+
+    memmove(p + n, rest, line + len - rest);
+    memcpy(p, num, n);
+    return len - (rest - p) + n;
+}
+
+static int fold_constants(uint8_t *line, int len) {
+    int changed = 1;
+
+    while (changed) {
+        uint8_t *p = line;
+        uint8_t prev = TOK_EOL;
+        uint8_t stmt = TOK_EOL;
+        changed = 0;
+
+        while (*p != TOK_EOL) {
+            uint8_t *q = p + tok_size(p);
+            int start = expr_start(prev, stmt);
+
+            if ((start || prev == TOK_PLUS || prev == TOK_MINUS) &&
+                is_num(p) && (*q == TOK_MUL || *q == TOK_DIV) &&
+                is_num(q + 1)) {
+                // NUM a * NUM b: first two factors of a term
+                int16_t v = num_at(p);
+                int16_t rhs = num_at(q + 1);
+                if (*q == TOK_MUL) v = MUL16(v, rhs);
+                else if (rhs) v = DIV16(v, rhs);
+                len = fold_replace(p, q + 1 + tok_size(q + 1), v, line, len);
+                changed = 1;
+                continue;
+            }
+            if (start && (is_num(p) || *p == TOK_PLUS || *p == TOK_MINUS)) {
+                // NUM a + NUM b, or + NUM b (a missing factor is 0),
+                // when NUM b is a whole term
+                uint8_t *op = is_num(p) ? q : p;
+                uint8_t *rest = op + 1;
+                if ((*op == TOK_PLUS || *op == TOK_MINUS) && is_num(rest))
+                    rest += tok_size(rest);
+                if (rest > op + 1 && *rest != TOK_MUL && *rest != TOK_DIV) {
+                    int16_t v = (op == p) ? 0 : num_at(p);
+                    int16_t rhs = num_at(op + 1);
+                    if (*op == TOK_PLUS) v += rhs;
+                    else v -= rhs;
+                    len = fold_replace(p, rest, v, line, len);
+                    changed = 1;
+                    continue;
+                }
+            }
+            if (*p == TOK_LPAREN && is_num(q) && q[tok_size(q)] == TOK_RPAREN &&
+                (start || prev == TOK_PLUS || prev == TOK_MINUS ||
+                 prev == TOK_MUL || prev == TOK_DIV)) {
+                // ( NUM a ) as a factor
+                len = fold_replace(p, q + tok_size(q) + 1, num_at(q), line, len);
+                changed = 1;
+                continue;
+            }
+
+            switch (*p) {
+                case TOK_LET: case TOK_PRINT: case TOK_INPUT: case TOK_GOTO:
+                case TOK_POKE: case TOK_SLEEP: case TOK_IF: case TOK_END:
+                case TOK_FOR: case TOK_NEXT: case TOK_GOSUB: case TOK_RETURN:
+                case TOK_DIM: case TOK_HIBERNATE: case TOK_TASK:
+                    stmt = *p;
+                    break;
+            }
+            prev = *p;
+            p = q;
+        }
     }
-    return v;
+    return len;
 }
 
-static int16_t term(uint8_t **pc) {
-    int16_t v = factor(pc);
-    while (**pc == TOK_MUL || **pc == TOK_DIV) {
-        uint8_t op = *(*pc)++;
-        int16_t rhs = factor(pc);
-        if (op == TOK_MUL) v *= rhs;
-        else if (rhs) v /= rhs;
+// A division by a nonzero literal is stored as TOK_DIVC, a multiply by
+// its reciprocal (see muldiv.h), so neither term() nor the compiled image
+// divide at run time; LIST prints the divisor back. The line grows by at
+// most a byte here, within the two bytes per source character that
+// tokenize() allows.
+static int lower_divisions(uint8_t *line, int len) {
+    for (uint8_t *p = line; *p != TOK_EOL; p += tok_size(p)) {
+        if (*p != TOK_DIV || !is_num(p + 1) || !num_at(p + 1)) continue;
+        uint8_t shift;
+        uint16_t m = divc_magic(num_at(p + 1), &shift);
+        uint8_t *rest = p + 1 + tok_size(p + 1);
+        memmove(p + 4, rest, line + len - rest);
+        len += p + 4 - rest;
+        p[0] = TOK_DIVC;
+        p[1] = m & 0xFF;
+        p[2] = m >> 8;
+        p[3] = shift;
     }
-    return v;
+    return len;
 }
 
-static int16_t expr(uint8_t **pc) {
-    int16_t v = term(pc);
-    while (**pc == TOK_PLUS || **pc == TOK_MINUS) {
-        uint8_t op = *(*pc)++;
-        int16_t rhs = term(pc);
-        if (op == TOK_PLUS) v += rhs;
-        else v -= rhs;
+/* ================= ARRAYS ================= */
+
+// DIM A(n) takes n + 1 cells from a fixed arena, so A(0) to A(n) can be
+// used. Array names are apart from the variables A to Z, and every array
+// is released when the program is RUN. Built with ARRAY_CELLS=0, DIM
+// stops the program.
+
+#if ARRAY_CELLS
+static void reset_arrays(struct basic_ctx *ctx) {
+    ctx->arena_top = 0;
+    memset(ctx->arrays, 0, sizeof(ctx->arrays));
+}
+
+static void dim(struct basic_ctx *ctx, uint8_t v, int16_t n) {
+    if (ctx->arrays[v].size) {
+        ctx->fault = "Array already dimensioned";
+    } else if (n < 0 || n >= ARRAY_CELLS - ctx->arena_top) {
+        ctx->fault = "Out of array memory";
+    } else {
+        ctx->arrays[v].base = ctx->arena_top;
+        ctx->arrays[v].size = n + 1;
+        memset(ctx->arena + ctx->arena_top, 0, (n + 1) * sizeof(int16_t));
+        ctx->arena_top += n + 1;
     }
-    return v;
 }
 
-static int condition(uint8_t **pc) {
-    int16_t lhs = expr(pc);
-    uint8_t op = *(*pc)++;
-    int16_t rhs = expr(pc);
-    
-    switch (op) {
-        case TOK_LT: return lhs < rhs;
-        case TOK_GT: return lhs > rhs;
-        case TOK_LE: return lhs <= rhs;
-        case TOK_GE: return lhs >= rhs;
-        case TOK_NE: return lhs != rhs;
-        case TOK_EQEQ: return lhs == rhs;
-        case TOK_EQ: return lhs == rhs;
+// The cell holding A(i), or NULL with a fault if i is out of range
+static int16_t *element(struct basic_ctx *ctx, uint8_t v, int16_t i) {
+    if ((uint16_t)i >= ctx->arrays[v].size) {
+        ctx->fault = "Subscript out of range";
+        return NULL;
     }
-    return 0;
+    return ctx->arena + ctx->arrays[v].base + i;
+}
+#else
+static void reset_arrays(struct basic_ctx *ctx) {
+    (void)ctx;
 }
 
-/* ================= EXECUTION ================= */
+static void dim(struct basic_ctx *ctx, uint8_t v, int16_t n) {
+    (void)v;
+    (void)n;
+    ctx->fault = "Out of array memory";
+}
 
-static uint8_t *find_line(uint16_t line) {
-    uint8_t *p = program;
-    while (p < program + prog_len) {
-        uint16_t ln = p[0] | (p[1] << 8);
-        if (ln == line) return p;
-        p += 3 + p[2];
-    }
+static int16_t *element(struct basic_ctx *ctx, uint8_t v, int16_t i) {
+    (void)v;
+    (void)i;
+    ctx->fault = "Subscript out of range";
     return NULL;
 }
+#endif
 
-static void delete_line(uint16_t ln) {
-    uint8_t *p = program;
+/* ================= MEMORY ================= */
 
-    while (p < program + prog_len) {
-        uint16_t cur = p[0] | (p[1] << 8);
-        uint8_t len = p[2];
-        uint16_t total = 3 + len;
+// FRE(n) is what is left of a fixed store: 0 the program store in bytes,
+// 1 the array arena in cells and 2 the string arena in bytes, including
+// what the next compaction would reclaim.
+static int16_t fre(struct basic_ctx *ctx, int16_t n) {
+    uint32_t v = 0;
 
-        if (cur == ln) {
-            memmove(p, p + total,
-                    (program + prog_len) - (p + total));
-            prog_len -= total;
-            return;
-        }
-        p += total;
+    switch (n) {
+        case 0: v = MAX_PROG - ctx->prog_len; break;
+#if ARRAY_CELLS
+        case 1: v = ARRAY_CELLS - ctx->arena_top; break;
+#endif
+#if STRING_ARENA
+        case 2: v = STRING_ARENA - ctx->str_used; break;
+#endif
     }
+    return v > 32767 ? 32767 : v;
 }
 
-static void insert_line(uint16_t ln, uint8_t *buf, int len) {
-    uint8_t *p = program;
-    
-    // Find insertion point
-    while (p < program + prog_len) {
-        uint16_t cur = p[0] | (p[1] << 8);
-        if (cur > ln) break;
-        p += 3 + p[2];
-    }
-    
-    // Make space
-    if (p < program + prog_len) {
-        memmove(p + 3 + len, p, (program + prog_len) - p);
+// Expressions are parsed by recursion, so parentheses, LEN and MID$ may
+// only nest EXPR_DEPTH deep before a statement stops with a fault rather
+// than run the C stack out.
+static int nest(struct basic_ctx *ctx) {
+    if (ctx->expr_depth == EXPR_DEPTH) {
+        ctx->fault = "Expression too complex";
+        return 0;
     }
-    
-    // Insert new line
-    *p++ = ln & 0xFF;
-    *p++ = ln >> 8;
-    *p++ = len;
-    memcpy(p, buf, len);
-    
-    prog_len += 3 + len;
+    if (++ctx->expr_depth > ctx->stats[STAT_MAX_DEPTH])
+        ctx->stats[STAT_MAX_DEPTH] = ctx->expr_depth;
+    return 1;
 }
 
-// Handler for INPUT statement response
-static uint8_t current_input_var = 0;
+// The C stack used below the entry point that called in, sampled where
+// the evaluators are deepest. Stacks are taken to grow down.
+static void stack_enter(struct basic_ctx *ctx) {
+    uint8_t here;
+    ctx->stack_base = (uintptr_t)&here;
+}
 
-static void handle_input_response(uint8_t *line) {
-    // Parse the input value
-    int val = atoi((char*)line);
-    vars[current_input_var] = val;
-    
-    // Resume execution from where we left off
-    if (execution_pc) {
-        run_from(execution_pc);
-        execution_pc = NULL;
-    }
+static void stack_mark(struct basic_ctx *ctx) {
+    uint8_t here;
+    uintptr_t sp = (uintptr_t)&here;
+
+    if (sp < ctx->stack_base &&
+        ctx->stack_base - sp > ctx->stats[STAT_STACK_MAX])
+        ctx->stats[STAT_STACK_MAX] = ctx->stack_base - sp;
 }
 
-static void request_input(void) {
-    current_input_mode = INPUT_MODE_AWAITING_INPUT;
-    printf("? ");
-#ifdef TARGET_LINUX
-    fflush(stdout);
-#endif
+/* ================= STRINGS ================= */
+
+// A$ to Z$ hold strings of up to MAX_STRING bytes. Their bytes, and those
+// of the temporaries a string expression builds, come from a fixed arena
+// of STRING_ARENA bytes and are only reached through handles: strs[0] to
+// strs[25] are the variables and the entries after them a stack of
+// temporaries. Space is taken from the top of the arena and a replaced
+// value is left behind. Only when the top reaches the end are the live
+// strings slid down and their handles updated, so no pointer into the
+// arena may be kept across an allocation. Strings are cleared by RUN.
+//
+// String expressions are not compiled. They are kept as tokens in the
+// compiled image too, and their numeric arguments go through expr().
+#define MAX_STRING 255
+
+static int str_start(uint8_t tok) {
+    return tok == TOK_STR || tok == TOK_SVAR || tok == TOK_MID;
 }
 
-/* ================= CONSOLIDATED STATEMENT EXECUTION ================= */
+#if STRING_ARENA
 
-// Return values:
-//   1: Continue normally
-//   0: PC was changed (GOTO), don't advance
-//  -1: Stop execution (END or INPUT waiting)
-static int execute_statement(uint8_t **ip, uint8_t **pc) {
-    uint8_t tok = *(*ip)++;
-    
-    switch (tok) {
-        case TOK_LET:
-            if (*(*ip)++ == TOK_VAR) {
-                uint8_t v = *(*ip)++;
-                if (*(*ip) == TOK_EQ) (*ip)++;
-                vars[v] = expr(ip);
-            }
-            break;
-            
-        case TOK_POKE: {
-            int16_t addr = expr(ip);
-            if (*(*ip) == TOK_COMMA) (*ip)++;
-            int16_t val = expr(ip);
-            hw_poke(addr & 0xff, val & 0xff);
+#define STR_TEMP(n) (NUM_VARS + (n))
+
+static void str_reset(struct basic_ctx *ctx) {
+    ctx->str_top = 0;
+    ctx->str_used = 0;
+    ctx->str_sp = 0;
+    memset(ctx->strs, 0, sizeof(ctx->strs));
+}
+
+// Point handle h at len bytes at off, keeping count of the bytes in use
+static void str_set(struct basic_ctx *ctx, uint8_t h, uint16_t off,
+                    uint8_t len) {
+    ctx->str_used += len - ctx->strs[h].len;
+    ctx->strs[h].off = off;
+    ctx->strs[h].len = len;
+    if (ctx->str_used > ctx->stats[STAT_STRING_PEAK])
+        ctx->stats[STAT_STRING_PEAK] = ctx->str_used;
+}
+
+// Slide the live strings down to the bottom of the arena, in order
+static void str_collect(struct basic_ctx *ctx) {
+    uint8_t count = STR_TEMP(ctx->str_sp);
+    uint16_t top = 0;
+    int32_t done = -1;      // old offset of the last string moved
+
+    for (;;) {
+        uint8_t next = count;
+        for (uint8_t h = 0; h < count; h++) {
+            if (ctx->strs[h].len && ctx->strs[h].off > done &&
+                (next == count || ctx->strs[h].off < ctx->strs[next].off))
+                next = h;
+        }
+        if (next == count) break;
+        done = ctx->strs[next].off;
+        memmove(ctx->str_arena + top, ctx->str_arena + done,
+                ctx->strs[next].len);
+        ctx->strs[next].off = top;
+        top += ctx->strs[next].len;
+    }
+    ctx->str_top = top;
+    ctx->stats[STAT_STRING_GCS]++;
+}
+
+// Make sure len bytes are free at the top, compacting if they are not
+static int str_room(struct basic_ctx *ctx, uint16_t len) {
+    if (STRING_ARENA - ctx->str_top < len) str_collect(ctx);
+    if (STRING_ARENA - ctx->str_top < len) {
+        ctx->fault = "Out of string space";
+        return 0;
+    }
+    return 1;
+}
+
+// A new temporary of len bytes, or a fault
+static uint8_t str_push(struct basic_ctx *ctx, uint16_t len) {
+    if (len > MAX_STRING) {
+        ctx->fault = "String too long";
+        return 0;
+    }
+    if (ctx->str_sp == STRING_TEMPS) {
+        ctx->fault = "String expression too complex";
+        return 0;
+    }
+    if (!str_room(ctx, len)) return 0;
+
+    uint8_t h = STR_TEMP(ctx->str_sp++);
+    str_set(ctx, h, ctx->str_top, len);
+    ctx->str_top += len;
+    return h;
+}
+
+// Drop the temporaries from slot n up. Bytes at the top of the arena are
+// handed back at once; the rest wait for the next compaction.
+static void str_pop(struct basic_ctx *ctx, uint8_t n) {
+    while (ctx->str_sp > n) {
+        uint8_t h = STR_TEMP(--ctx->str_sp);
+        if (ctx->strs[h].off + ctx->strs[h].len == ctx->str_top)
+            ctx->str_top = ctx->strs[h].off;
+        str_set(ctx, h, 0, 0);
+    }
+}
+
+static void str_drop(struct basic_ctx *ctx, uint8_t h) {
+    if (h >= NUM_VARS) str_pop(ctx, h - NUM_VARS);
+}
+
+// Leave temporary t as the result in slot n, dropping the operands
+// between them
+static uint8_t str_keep(struct basic_ctx *ctx, uint8_t n, uint8_t t) {
+    uint8_t h = STR_TEMP(n);
+
+    if (t != h) {
+        for (uint8_t i = h; i < t; i++) str_set(ctx, i, 0, 0);
+        ctx->strs[h] = ctx->strs[t];
+        ctx->strs[t].len = 0;
+        ctx->str_sp = n + 1;
+    }
+    return h;
+}
+
+// Give the bytes of temporary h, the newest, to variable v
+static void str_assign(struct basic_ctx *ctx, uint8_t v, uint8_t h) {
+    str_set(ctx, v, 0, 0);
+    ctx->strs[v] = ctx->strs[h];
+    ctx->strs[h].len = 0;
+    ctx->str_sp = h - NUM_VARS;
+}
+
+// a + b, where a is in slot n if it is a temporary
+static uint8_t str_concat(struct basic_ctx *ctx, uint8_t n, uint8_t a,
+                          uint8_t b) {
+    if (ctx->fault) return a;
+
+    uint16_t la = ctx->strs[a].len;
+    uint16_t lb = ctx->strs[b].len;
+    if (la + lb > MAX_STRING) {
+        ctx->fault = "String too long";
+        return a;
+    }
+
+    if (a >= NUM_VARS) {
+        uint16_t end = ctx->strs[a].off + la;
+        if (b >= NUM_VARS && ctx->strs[b].off == end) {
+            // b was built straight after a
+            str_set(ctx, b, 0, 0);
+            str_set(ctx, a, ctx->strs[a].off, la + lb);
+            ctx->str_sp = n + 1;
+            return a;
+        }
+        if (end == ctx->str_top) {
+            // a is the newest string, and stays so if the arena is
+            // compacted: copy b on after it
+            if (!str_room(ctx, lb)) return a;
+            memcpy(ctx->str_arena + ctx->str_top,
+                   ctx->str_arena + ctx->strs[b].off, lb);
+            ctx->str_top += lb;
+            str_set(ctx, a, ctx->strs[a].off, la + lb);
+            str_pop(ctx, n + 1);
+            return a;
+        }
+    }
+
+    uint8_t t = str_push(ctx, la + lb);
+    if (ctx->fault) return a;
+    uint8_t *d = ctx->str_arena + ctx->strs[t].off;
+    memcpy(d, ctx->str_arena + ctx->strs[a].off, la);
+    memcpy(d + la, ctx->str_arena + ctx->strs[b].off, lb);
+    return str_keep(ctx, n, t);
+}
+
+static uint8_t sexpr(struct basic_ctx *ctx, uint8_t **pc);
+
+// A literal, a variable or MID$(s, start[, count]) with start from 1
+static uint8_t sterm(struct basic_ctx *ctx, uint8_t **pc) {
+    stack_mark(ctx);
+    if (**pc == TOK_STR) {
+        uint8_t len = (*pc)[1];
+        uint8_t *src = *pc + 2;
+        *pc += 2 + len;
+        uint8_t h = str_push(ctx, len);
+        if (!ctx->fault)
+            memcpy(ctx->str_arena + ctx->strs[h].off, src, len);
+        return h;
+    }
+    if (**pc == TOK_SVAR) {
+        *pc += 2;
+        return (*pc)[-1];
+    }
+    if (**pc == TOK_MID) {
+        (*pc)++;
+        if (**pc == TOK_LPAREN) (*pc)++;
+        uint8_t s = sexpr(ctx, pc);
+        int16_t start = 1;
+        int16_t count = MAX_STRING;
+        if (**pc == TOK_COMMA) {
+            (*pc)++;
+            start = expr(ctx, pc);
+        }
+        if (**pc == TOK_COMMA) {
+            (*pc)++;
+            count = expr(ctx, pc);
+        }
+        if (**pc == TOK_RPAREN) (*pc)++;
+        if (ctx->fault) return s;
+
+        uint8_t len = ctx->strs[s].len;
+        uint8_t from = start < 1 ? 0 : start > len ? len : start - 1;
+        if (count < 0) count = 0;
+        if (count > len - from) count = len - from;
+        if (s >= NUM_VARS) {
+            // a temporary is cut down where it is
+            str_set(ctx, s, ctx->strs[s].off + from, count);
+            return s;
+        }
+        uint8_t t = str_push(ctx, count);
+        if (!ctx->fault)
+            memcpy(ctx->str_arena + ctx->strs[t].off,
+                   ctx->str_arena + ctx->strs[s].off + from, count);
+        return t;
+    }
+    ctx->fault = "Type mismatch";
+    return 0;
+}
+
+// Terms joined by +. The result is a variable's handle or a temporary,
+// which the caller drops once it is done with it.
+static uint8_t sexpr(struct basic_ctx *ctx, uint8_t **pc) {
+    if (!nest(ctx)) return 0;
+
+    uint8_t n = ctx->str_sp;
+    uint8_t h = sterm(ctx, pc);
+
+    while (!ctx->fault && **pc == TOK_PLUS) {
+        (*pc)++;
+        h = str_concat(ctx, n, h, sterm(ctx, pc));
+    }
+    ctx->expr_depth--;
+    return h;
+}
+
+// LEN( string ), for factor() and the compiled TOK_LEN
+static int16_t str_length(struct basic_ctx *ctx, uint8_t **pc) {
+    if (**pc == TOK_LPAREN) (*pc)++;
+    uint8_t h = sexpr(ctx, pc);
+    if (**pc == TOK_RPAREN) (*pc)++;
+    if (ctx->fault) return 0;
+
+    int16_t len = ctx->strs[h].len;
+    str_drop(ctx, h);
+    return len;
+}
+
+// Two strings compared byte by byte, a prefix before the longer string
+static int str_condition(struct basic_ctx *ctx, uint8_t **pc) {
+    uint8_t a = sexpr(ctx, pc);
+    uint8_t op = **pc;
+    if (op != TOK_EOL) (*pc)++;
+    uint8_t b = sexpr(ctx, pc);
+    if (ctx->fault) return 0;
+
+    uint8_t la = ctx->strs[a].len;
+    uint8_t lb = ctx->strs[b].len;
+    int c = memcmp(ctx->str_arena + ctx->strs[a].off,
+                   ctx->str_arena + ctx->strs[b].off, la < lb ? la : lb);
+    if (!c) c = la - lb;
+    str_drop(ctx, b);
+    str_drop(ctx, a);
+
+    switch (op) {
+        case TOK_LT: return c < 0;
+        case TOK_GT: return c > 0;
+        case TOK_LE: return c <= 0;
+        case TOK_GE: return c >= 0;
+        case TOK_NE: return c != 0;
+        case TOK_EQEQ: return c == 0;
+        case TOK_EQ: return c == 0;
+    }
+    return 0;
+}
+
+// LET v$ = string
+static void str_let(struct basic_ctx *ctx, uint8_t v, uint8_t **pc) {
+    uint8_t h = sexpr(ctx, pc);
+    if (ctx->fault || h == v) return;
+
+    if (h < NUM_VARS) {
+        // another variable: copy its value
+        uint8_t t = str_push(ctx, ctx->strs[h].len);
+        if (ctx->fault) return;
+        memcpy(ctx->str_arena + ctx->strs[t].off,
+               ctx->str_arena + ctx->strs[h].off, ctx->strs[h].len);
+        h = t;
+    }
+    str_assign(ctx, v, h);
+}
+
+static void str_print(struct basic_ctx *ctx, uint8_t **pc) {
+    uint8_t h = sexpr(ctx, pc);
+    if (ctx->fault) return;
+
+    print(ctx, ctx->strs[h].len, ctx->str_arena + ctx->strs[h].off);
+    str_drop(ctx, h);
+}
+
+// A line typed for INPUT v$, without its line ending
+static void str_input(struct basic_ctx *ctx, uint8_t v, uint8_t *line) {
+    size_t len = strcspn((char*)line, "\r\n");
+    if (len > MAX_STRING) len = MAX_STRING;
+
+    uint8_t h = str_push(ctx, len);
+    if (ctx->fault) return;
+    memcpy(ctx->str_arena + ctx->strs[h].off, line, len);
+    str_assign(ctx, v, h);
+}
+
+#else
+
+// Built with STRING_ARENA=0: string variables stop the program
+
+static void str_reset(struct basic_ctx *ctx) {
+    (void)ctx;
+}
+
+static void str_pop(struct basic_ctx *ctx, uint8_t n) {
+    (void)ctx;
+    (void)n;
+}
+
+static int16_t str_length(struct basic_ctx *ctx, uint8_t **pc) {
+    (void)pc;
+    ctx->fault = "No string space";
+    return 0;
+}
+
+static int str_condition(struct basic_ctx *ctx, uint8_t **pc) {
+    return str_length(ctx, pc);
+}
+
+static void str_let(struct basic_ctx *ctx, uint8_t v, uint8_t **pc) {
+    (void)v;
+    str_length(ctx, pc);
+}
+
+static void str_print(struct basic_ctx *ctx, uint8_t **pc) {
+    str_length(ctx, pc);
+}
+
+static void str_input(struct basic_ctx *ctx, uint8_t v, uint8_t *line) {
+    (void)v;
+    (void)line;
+    ctx->fault = "No string space";
+}
+
+#endif
+
+/* ================= EXPRESSIONS ================= */
+
+static int16_t factor(struct basic_ctx *ctx, uint8_t **pc) {
+    int16_t v = 0;
+
+    stack_mark(ctx);
+
+    if (IS_VAR(**pc)) {
+        uint8_t var = *(*pc)++ - TOK_VAR;
+        if (**pc == TOK_LPAREN) {
+            (*pc)++;
+            int16_t *cell = element(ctx, var, expr(ctx, pc));
+            if (**pc == TOK_RPAREN) (*pc)++;
+            v = cell ? *cell : 0;
+        } else {
+            v = ctx->vars[var];
+        }
+    }
+    else if (**pc == TOK_BYTE) {
+        v = (*pc)[1];
+        *pc += 2;
+    }
+    else if (**pc == TOK_NUM) {
+        v = (*pc)[1] | ((*pc)[2] << 8);
+        *pc += 3;
+    }
+    else if (**pc == TOK_STR) {
+        (*pc)++;
+        uint8_t len = *(*pc)++;
+        *pc += len;
+        v = 0;
+    }
+    else if (**pc == TOK_PEEK) {
+        (*pc)++;
+        if (**pc == TOK_LPAREN) (*pc)++;
+        int16_t addr = expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+        v = peek(ctx, addr & 0xff);
+    }
+    else if (**pc == TOK_FRE) {
+        (*pc)++;
+        if (**pc == TOK_LPAREN) (*pc)++;
+        int16_t n = expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+        v = fre(ctx, n);
+    }
+    else if (**pc == TOK_LEN) {
+        (*pc)++;
+        v = str_length(ctx, pc);
+    }
+    else if (**pc == TOK_SVAR || **pc == TOK_MID) {
+        ctx->fault = "Type mismatch";
+    }
+    else if (**pc == TOK_LPAREN) {
+        (*pc)++;
+        v = expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+    }
+    return v;
+}
+
+static int16_t term(struct basic_ctx *ctx, uint8_t **pc) {
+    int16_t v = factor(ctx, pc);
+    while (**pc == TOK_MUL || **pc == TOK_DIV || **pc == TOK_DIVC) {
+        uint8_t op = *(*pc)++;
+        if (op == TOK_DIVC) {
+            v = divc(v, (*pc)[0] | ((*pc)[1] << 8), (*pc)[2]);
+            *pc += 3;
+            continue;
+        }
+        int16_t rhs = factor(ctx, pc);
+        if (op == TOK_MUL) v = MUL16(v, rhs);
+        else if (rhs) v = DIV16(v, rhs);
+    }
+    return v;
+}
+
+static int16_t expr(struct basic_ctx *ctx, uint8_t **pc) {
+    if (!nest(ctx)) return 0;
+
+    int16_t v = term(ctx, pc);
+    while (**pc == TOK_PLUS || **pc == TOK_MINUS) {
+        uint8_t op = *(*pc)++;
+        int16_t rhs = term(ctx, pc);
+        if (op == TOK_PLUS) v += rhs;
+        else v -= rhs;
+    }
+
+    ctx->expr_depth--;
+    return v;
+}
+
+static int condition(struct basic_ctx *ctx, uint8_t **pc) {
+    if (str_start(**pc)) return str_condition(ctx, pc);
+
+    int16_t lhs = expr(ctx, pc);
+    uint8_t op = **pc;
+    if (op != TOK_EOL) (*pc)++;
+    int16_t rhs = expr(ctx, pc);
+    
+    switch (op) {
+        case TOK_LT: return lhs < rhs;
+        case TOK_GT: return lhs > rhs;
+        case TOK_LE: return lhs <= rhs;
+        case TOK_GE: return lhs >= rhs;
+        case TOK_NE: return lhs != rhs;
+        case TOK_EQEQ: return lhs == rhs;
+        case TOK_EQ: return lhs == rhs;
+    }
+    return 0;
+}
+
+/* ================= LINE CACHE ================= */
+
+// Built with -DLINE_CACHE=n on a target with the F-RAM filesystem,
+// RUN name runs a SAVEd program where it lies in F-RAM instead of loading
+// it into program[], so it can be many times larger. Its lines are read
+// into n slots of CACHE_LINE bytes as execution reaches them. A miss also
+// reads the line after, where execution usually goes next, and takes the
+// least recently used slot; the slot of the line being run is never
+// taken. Positions saved for later (GOSUB returns, FOR bodies, other
+// tasks) point into the slots: when a slot is taken, those in it note
+// their line's offset in the file, and resuming one reads the line back.
+// One pass over the file at RUN checks it and keeps the offset of every
+// file_stride-th line in line_index[] for line searches.
+#if LINE_CACHE
+
+#if LINE_CACHE < 2 || LINE_CACHE > 254 || CACHE_LINE > 255
+#error "LINE_CACHE takes 2 to 254 slots of at most 255 bytes"
+#endif
+
+#define NO_SLOT 0xFF
+#define FROM_FILE(ctx) ((ctx)->exec_base == (ctx)->cache[0])
+
+uint8_t fram_read(int addr);
+int hw_open(const char *filename, uint32_t *addr, uint16_t *len);
+
+static uint8_t file_byte(struct basic_ctx *ctx, uint16_t off) {
+    return fram_read(ctx->file_addr + off);
+}
+
+static uint16_t file_num(struct basic_ctx *ctx, uint16_t off) {
+    return file_byte(ctx, off) | (file_byte(ctx, off + 1) << 8);
+}
+
+// Read the line at off into buf, walking its tokens as line_end() does.
+// Returns its size, or 0 if it does not end within CACHE_LINE bytes and
+// the file.
+static uint8_t file_read_line(struct basic_ctx *ctx, uint16_t off,
+                              uint8_t *buf) {
+    uint16_t n = 0, tok = LINE_HEADER;
+
+    while (n < CACHE_LINE && off + n < ctx->file_len) {
+        buf[n] = file_byte(ctx, off + n);
+        n++;
+        if (n == tok + 1 && buf[tok] == TOK_EOL) return n;
+        // a string's size is known once its length byte is in
+        if (n > tok && n == tok + (buf[tok] == TOK_STR ? 2 : 1))
+            tok += tok_size(buf + tok);
+    }
+    return 0;
+}
+
+// Size of the line at off, reading only its token bytes
+static uint16_t file_line_size(struct basic_ctx *ctx, uint16_t off) {
+    uint8_t t[2] = { 0, 0 };
+    uint16_t p = off + LINE_HEADER;
+
+    while ((t[0] = file_byte(ctx, p)) != TOK_EOL) {
+        if (t[0] == TOK_STR) t[1] = file_byte(ctx, p + 1);
+        p += tok_size(t);
+    }
+    return p + 1 - off;
+}
+
+// Check that the file holds whole lines in ascending order and sample
+// them into line_index[]. Whenever the index fills up, the stride doubles
+// and every other entry goes.
+static int file_index(struct basic_ctx *ctx) {
+    uint16_t off = 0, n = 0;
+    int32_t prev = -1;
+
+    ctx->line_count = 0;
+    ctx->file_stride = 1;
+    while (off < ctx->file_len) {
+        uint8_t len = file_read_line(ctx, off, ctx->cache[0]);
+        if (!len || LINE_NUM(ctx->cache[0]) <= prev) return 0;
+        prev = LINE_NUM(ctx->cache[0]);
+
+        if (n % ctx->file_stride == 0 && ctx->line_count == MAX_LINES) {
+            ctx->file_stride *= 2;
+            ctx->line_count = (MAX_LINES + 1) / 2;
+            for (uint16_t i = 1; i < ctx->line_count; i++)
+                ctx->line_index[i] = ctx->line_index[2 * i];
+        }
+        if (n++ % ctx->file_stride == 0)
+            ctx->line_index[ctx->line_count++] = off;
+        off += len;
+    }
+    return 1;
+}
+
+// Offset of the first line whose number is >= line, or file_len: a binary
+// search of the sampled lines, then a walk of less than file_stride lines
+static uint16_t file_lower_bound(struct basic_ctx *ctx, uint16_t line) {
+    uint16_t lo = 0, hi = ctx->line_count;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (file_num(ctx, ctx->line_index[mid]) <= line) lo = mid + 1;
+        else hi = mid;
+    }
+
+    uint16_t start = lo ? ctx->line_index[lo - 1] : 0;
+    uint16_t off = start;
+    while (off < ctx->file_len && file_num(ctx, off) < line)
+        off += file_line_size(ctx, off);
+    ctx->stats[STAT_SCANNED] += off - start;
+    return off;
+}
+
+static uint8_t cache_find(struct basic_ctx *ctx, uint16_t off) {
+    for (uint8_t s = 0; s < LINE_CACHE; s++)
+        if (ctx->cache_tag[s].pos == off + 1) return s;
+    return NO_SLOT;
+}
+
+static void cache_mark(struct basic_ctx *ctx, struct resume *r, uint8_t s) {
+    if (!r->pos && r->pc >= ctx->cache[s] && r->pc < ctx->cache[s] + CACHE_LINE)
+        r->pos = ctx->cache_tag[s].pos;
+}
+
+// Slot s is about to be taken: saved positions in it note their line
+static void cache_evict(struct basic_ctx *ctx, uint8_t s) {
+    for (uint8_t n = 0; n < MAX_TASKS; n++) {
+        struct task *t = &ctx->tasks[n];
+        cache_mark(ctx, &t->at, s);
+        for (uint8_t i = 0; i < FOR_DEPTH; i++)
+            cache_mark(ctx, &t->fors[i].body, s);
+        for (uint8_t i = 0; i < GOSUB_DEPTH; i++)
+            cache_mark(ctx, &t->gosubs[i], s);
+    }
+    cache_mark(ctx, &ctx->step_at, s);
+}
+
+// Read the line at off into the least recently used slot other than the
+// pinned one and keep, if there is one
+static uint8_t cache_fill(struct basic_ctx *ctx, uint16_t off, uint8_t keep) {
+    uint8_t v = NO_SLOT;
+
+    for (uint8_t s = 0; s < LINE_CACHE; s++) {
+        if (s == keep || ctx->cache[s] == ctx->cache_pin) continue;
+        if (v == NO_SLOT || ctx->cache_tag[s].used < ctx->cache_tag[v].used)
+            v = s;
+    }
+    if (v == NO_SLOT) return v;
+
+    if (ctx->cache_tag[v].pos) cache_evict(ctx, v);
+    ctx->cache_tag[v].len = file_read_line(ctx, off, ctx->cache[v]);
+    ctx->cache_tag[v].pos = off + 1;
+    ctx->cache_tag[v].used = ctx->cache_clock;
+    return v;
+}
+
+// The line at off, from its slot or else from F-RAM along with the next
+static uint8_t *cache_line(struct basic_ctx *ctx, uint16_t off) {
+    uint8_t s = cache_find(ctx, off);
+
+    ctx->cache_clock++;
+    if (s != NO_SLOT) {
+        ctx->stats[STAT_CACHE_HITS]++;
+    } else {
+        ctx->stats[STAT_CACHE_MISSES]++;
+        s = cache_fill(ctx, off, NO_SLOT);
+        uint16_t next = off + ctx->cache_tag[s].len;
+        if (next < ctx->file_len && cache_find(ctx, next) == NO_SLOT)
+            cache_fill(ctx, next, s);
+    }
+    ctx->cache_tag[s].used = ctx->cache_clock;
+    return ctx->cache[s];
+}
+
+// The line after the one at pc, or the end of the exec store
+static uint8_t *cache_next(struct basic_ctx *ctx, uint8_t *pc) {
+    uint8_t s = (pc - ctx->cache[0]) / CACHE_LINE;
+    uint16_t off = ctx->cache_tag[s].pos - 1 + ctx->cache_tag[s].len;
+
+    return off < ctx->file_len ? cache_line(ctx, off) : ctx->cache[LINE_CACHE];
+}
+
+// Read a saved position's line back and move the position to its slot
+static void cache_resume(struct basic_ctx *ctx, struct resume *r) {
+    uint8_t *old = r->pc;
+    uint8_t *line = cache_line(ctx, r->pos - 1);
+
+    if (r->ip) r->ip = line + (r->ip - old);
+    if (r->end >= old && r->end < old + CACHE_LINE)
+        r->end = line + (r->end - old);
+    r->pc = line;
+    r->pos = 0;
+}
+
+// find_line() for a program run from a file; GOTO_CACHE keeps offsets
+static uint8_t *file_find_line(struct basic_ctx *ctx, uint16_t line,
+                               uint8_t slot) {
+    uint16_t off;
+
+#if GOTO_CACHE
+    if (ctx->goto_cache[slot].pos && ctx->goto_cache[slot].line == line)
+        return cache_line(ctx, ctx->goto_cache[slot].pos - 1);
+#endif
+    off = file_lower_bound(ctx, line);
+    if (off == ctx->file_len || file_num(ctx, off) != line) return NULL;
+#if GOTO_CACHE
+    ctx->goto_cache[slot].line = line;
+    ctx->goto_cache[slot].pos = off + 1;
+#endif
+    return cache_line(ctx, off);
+}
+
+// Keep the line at p in its slot; a saved position r is read back first
+// if its slot has been taken
+#define PIN(p)    (ctx->cache_pin = (p))
+#define RESUME(r) do { if ((r)->pos) cache_resume(ctx, r); } while (0)
+#else
+#define PIN(p)
+#define RESUME(r)
+#endif
+
+/* ================= LINE INDEX ================= */
+
+// Offsets of every line in program[], in line-number order. Rebuilt when
+// the program runs; if the program has more than MAX_LINES lines the index
+// is marked unusable and lookups fall back to walking the store. A
+// direct-mapped cache of resolved GOTO targets makes a branch to a given
+// line cost one lookup no matter where the line sits, and IFs run straight
+// from program[] keep their ELSE positions in another; compiled lines
+// carry theirs inline. MAX_LINES, GOTO_CACHE and IF_CACHE set to 0 leave
+// out the index and the caches, and every lookup walks the store.
+
+static void goto_cache_clear(struct basic_ctx *ctx) {
+#if GOTO_CACHE
+    memset(ctx->goto_cache, 0, sizeof(ctx->goto_cache));
+#else
+    (void)ctx;
+#endif
+}
+
+static void index_program(struct basic_ctx *ctx) {
+    ctx->line_count = 0;
+#if MAX_LINES
+    uint8_t *p = ctx->program;
+
+    ctx->index_ok = 1;
+    while (p < ctx->program + ctx->prog_len) {
+        if (ctx->line_count == MAX_LINES) {
+            ctx->index_ok = 0;
+            break;
+        }
+        ctx->line_index[ctx->line_count++] = p - ctx->program;
+        p += LINE_SIZE(p);
+    }
+    ctx->exec_index = ctx->line_index;
+#else
+    ctx->index_ok = 0;
+    ctx->exec_index = NULL;
+#endif
+
+    ctx->exec_base = ctx->program;
+    ctx->exec_len = ctx->prog_len;
+    goto_cache_clear(ctx);
+#if IF_CACHE
+    memset(ctx->if_cache, 0, sizeof(ctx->if_cache));
+#endif
+}
+
+// Position of the first indexed line whose number is >= line
+static uint16_t index_search(struct basic_ctx *ctx, uint8_t *base,
+                             uint16_t *index, uint16_t line) {
+    uint16_t lo = 0, hi = ctx->line_count;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (LINE_NUM(base + index[mid]) < line) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// First line whose number is >= line in a store (or the end of the store)
+static uint8_t *lower_bound(struct basic_ctx *ctx, uint8_t *base,
+                            uint16_t *index, uint16_t len, uint16_t line) {
+    if (ctx->index_ok) {
+        uint16_t i = index_search(ctx, base, index, line);
+        return i < ctx->line_count ? base + index[i] : base + len;
+    }
+
+    uint8_t *p = base;
+    while (p < base + len && LINE_NUM(p) < line)
+        p += LINE_SIZE(p);
+    ctx->stats[STAT_SCANNED] += p - base;
+    return p;
+}
+
+// Find a line in the exec store
+static uint8_t *find_line(struct basic_ctx *ctx, uint16_t line) {
+#if GOTO_CACHE
+    uint8_t slot = line & (GOTO_CACHE - 1);
+#else
+    uint8_t slot = 0;
+#endif
+
+    ctx->stats[STAT_FIND_LINE]++;
+#if LINE_CACHE
+    if (FROM_FILE(ctx)) return file_find_line(ctx, line, slot);
+#endif
+#if GOTO_CACHE
+    if (ctx->goto_cache[slot].pos && ctx->goto_cache[slot].line == line)
+        return ctx->exec_base + ctx->goto_cache[slot].pos - 1;
+#endif
+
+    uint8_t *p = lower_bound(ctx, ctx->exec_base, ctx->exec_index,
+                             ctx->exec_len, line);
+    if (p == ctx->exec_base + ctx->exec_len || LINE_NUM(p) != line) return NULL;
+
+#if GOTO_CACHE
+    ctx->goto_cache[slot].line = line;
+    ctx->goto_cache[slot].pos = p - ctx->exec_base + 1;
+#else
+    (void)slot;
+#endif
+    return p;
+}
+
+// Find the ELSE belonging to an IF, or the TOK_EOL ending its line,
+// scanning from the first token of the THEN clause. ELSEs after a nested
+// IF belong to that IF.
+static uint8_t *find_else(uint8_t *ip) {
+    int depth = 0;
+
+    while (*ip != TOK_EOL) {
+        if (*ip == TOK_IF) depth++;
+        else if (*ip == TOK_ELSE && depth == 0) break;
+        ip += tok_size(ip);
+    }
+    return ip;
+}
+
+static uint8_t *cached_else(struct basic_ctx *ctx, uint8_t *site, uint8_t *ip) {
+#if LINE_CACHE
+    // a slot holds different lines over time
+    if (FROM_FILE(ctx)) return find_else(ip);
+#endif
+#if !IF_CACHE
+    (void)ctx;
+    (void)site;
+    return find_else(ip);
+#else
+    uint16_t pos = site - ctx->exec_base + 1;
+    uint8_t slot = pos & (IF_CACHE - 1);
+
+    if (ctx->if_cache[slot].pos == pos)
+        return site + ctx->if_cache[slot].else_off;
+
+    uint8_t *else_pos = find_else(ip);
+    ctx->if_cache[slot].pos = pos;
+    ctx->if_cache[slot].else_off = else_pos - site;
+    return else_pos;
+#endif
+}
+
+/* ================= PROGRAM STORE ================= */
+
+// program[] is a gap buffer: lines before the edit point sit at the start,
+// lines after it at the end, and entering a line only moves the lines
+// between the previous edit point and this one. Pasting a program in
+// either order therefore costs one copy per line. Anything that reads
+// program[] as a whole calls close_gap() first.
+
+static void close_gap(struct basic_ctx *ctx) {
+    uint8_t *program = ctx->program;
+    uint16_t gap = ctx->gap_end - ctx->gap_start;
+
+    for (uint8_t *p = program + ctx->gap_end; p < program + MAX_PROG;
+         p += LINE_SIZE(p))
+        ctx->gap_prev = p - program - gap;
+
+    memmove(program + ctx->gap_start, program + ctx->gap_end,
+            MAX_PROG - ctx->gap_end);
+    ctx->gap_start = ctx->prog_len;
+    ctx->gap_end = MAX_PROG;
+}
+
+// Put the (closed) gap after a freshly loaded program
+static void reset_gap(struct basic_ctx *ctx) {
+    uint8_t *program = ctx->program;
+    uint8_t *p = program;
+
+    ctx->gap_prev = NO_LINE;
+    while (p < program + ctx->prog_len) {
+        ctx->gap_prev = p - program;
+        p += LINE_SIZE(p);
+    }
+    ctx->gap_start = ctx->prog_len;
+    ctx->gap_end = MAX_PROG;
+}
+
+// Version 1 images had a length byte after the line number, variables
+// as V1_TOK_VAR and an index and every number as TOK_NUM; the other
+// tokens are unchanged. Lines only shrink, so the upgrade is done in
+// place. Returns 0 if the image is not a valid program.
+#define V1_TOK_VAR 5
+
+static int upgrade_image(struct basic_ctx *ctx, uint16_t len) {
+    uint8_t *in = ctx->program;
+    uint8_t *out = ctx->program;
+    uint8_t *end = in + len;
+
+    while (in < end) {
+        if (end - in < 4 || !in[2] || in[2] > end - in - 3) return 0;
+        uint8_t *next = in + 3 + in[2];
+        *out++ = in[0];
+        *out++ = in[1];
+        in += 3;
+        while (in < next) {
+            int n = *in == V1_TOK_VAR ? 2 : tok_size(in);
+            if (n > next - in) return 0;
+            if (*in == V1_TOK_VAR) {
+                if (in[1] >= NUM_VARS) return 0;
+                *out++ = TOK_VAR + in[1];
+            } else if (*in == TOK_NUM) {
+                out = emit_num(out, in[1] | (in[2] << 8));
+            } else {
+                memmove(out, in, n);
+                out += n;
+            }
+            in += n;
+        }
+        if (out[-1] != TOK_EOL) return 0;
+    }
+    ctx->prog_len = out - ctx->program;
+    return 1;
+}
+
+// Take a LOADed image of len bytes into the (empty) store
+static int load_image(struct basic_ctx *ctx, uint16_t len) {
+    uint8_t *p = ctx->program;
+
+    ctx->prog_len = 0;
+    if (len >= IMAGE_TRAILER && p[len - 2] == IMAGE_TAG &&
+        IMAGE_OK(p[len - 1])) {
+        ctx->prog_len = len - IMAGE_TRAILER;
+        return 1;
+    }
+    if (len > MAX_PROG || (len && p[len - 1] != TOK_EOL)) return 0;
+    return upgrade_image(ctx, len);
+}
+
+// Replace line ln with len tokens from buf, or delete it if len is 0
+static void store_line(struct basic_ctx *ctx, uint16_t ln, uint8_t *buf,
+                       int len) {
+    uint8_t *program = ctx->program;
+    ctx->stats[STAT_LINES_ENTERED]++;
+
+    if (ctx->gap_prev != NO_LINE && LINE_NUM(program + ctx->gap_prev) >= ln) {
+        // Line sorts before the gap: find it from the start and move
+        // everything from there on to the other side
+        uint8_t *p = program;
+        uint16_t prev = NO_LINE;
+        while (LINE_NUM(p) < ln) {
+            prev = p - program;
+            p += LINE_SIZE(p);
+        }
+        ctx->stats[STAT_SCANNED] += p - program;
+        uint16_t n = ctx->gap_start - (p - program);
+        ctx->gap_end -= n;
+        memmove(program + ctx->gap_end, p, n);
+        ctx->gap_start = p - program;
+        ctx->gap_prev = prev;
+    } else {
+        // Line sorts after the gap: move the lines in between across
+        while (ctx->gap_end < MAX_PROG &&
+               LINE_NUM(program + ctx->gap_end) < ln) {
+            uint16_t size = LINE_SIZE(program + ctx->gap_end);
+            memmove(program + ctx->gap_start, program + ctx->gap_end, size);
+            ctx->gap_prev = ctx->gap_start;
+            ctx->gap_start += size;
+            ctx->gap_end += size;
+        }
+    }
+
+    uint16_t old = 0;
+    if (ctx->gap_end < MAX_PROG && LINE_NUM(program + ctx->gap_end) == ln)
+        old = LINE_SIZE(program + ctx->gap_end);
+
+    if (len && LINE_HEADER + len > ctx->gap_end + old - ctx->gap_start) {
+        out_str(ctx, "Out of memory\r\n");
+        return;
+    }
+
+    ctx->gap_end += old;
+    ctx->prog_len -= old;
+
+    if (len) {
+        uint8_t *p = program + ctx->gap_start;
+        *p++ = ln & 0xFF;
+        *p++ = ln >> 8;
+        memcpy(p, buf, len);
+
+        ctx->gap_prev = ctx->gap_start;
+        ctx->gap_start += LINE_HEADER + len;
+        ctx->prog_len += LINE_HEADER + len;
+    }
+
+    // The index is rebuilt when the program next runs
+    ctx->line_count = 0;
+    ctx->index_ok = 0;
+}
+
+/* ================= PROFILER ================= */
+
+// Built with -DBASIC_PROFILE, run_from() counts how often each line is
+// entered and how long it runs, using a microsecond tick supplied by the
+// target, and how often it is the target of a GOTO. PROFILE prints the
+// result of the last RUN. Without the flag none of this is compiled.
+#ifdef BASIC_PROFILE
+
+// Ordinal of a line in the exec store, NO_LINE if the index is unusable
+static uint16_t prof_ordinal(struct basic_ctx *ctx, uint8_t *p) {
+#if LINE_CACHE
+    if (FROM_FILE(ctx)) return NO_LINE;
+#endif
+    if (!ctx->index_ok) return NO_LINE;
+    return index_search(ctx, ctx->exec_base, ctx->exec_index, LINE_NUM(p));
+}
+
+static void prof_reset(struct basic_ctx *ctx) {
+    memset(ctx->prof, 0, sizeof(ctx->prof));
+    ctx->prof_cur = NO_LINE;
+}
+
+// Charge the time since the last call to the current line
+static void prof_stop(struct basic_ctx *ctx) {
+    uint32_t now = hw_ticks();
+    if (ctx->prof_cur != NO_LINE)
+        ctx->prof[ctx->prof_cur].ticks += now - ctx->prof_start;
+    ctx->prof_cur = NO_LINE;
+    ctx->prof_start = now;
+}
+
+static void prof_line(struct basic_ctx *ctx, uint8_t *p) {
+    prof_stop(ctx);
+    ctx->prof_cur = prof_ordinal(ctx, p);
+    if (ctx->prof_cur != NO_LINE) ctx->prof[ctx->prof_cur].count++;
+}
+
+static void prof_goto(struct basic_ctx *ctx, uint8_t *p) {
+    uint16_t ord = prof_ordinal(ctx, p);
+    if (ord != NO_LINE) ctx->prof[ord].gotos++;
+}
+
+#define PROF_RESET()  prof_reset(ctx)
+#define PROF_LINE(p)  prof_line(ctx, p)
+#define PROF_STOP()   prof_stop(ctx)
+#define PROF_GOTO(p)  prof_goto(ctx, p)
+#else
+#define PROF_RESET()
+#define PROF_LINE(p)
+#define PROF_STOP()
+#define PROF_GOTO(p)
+#endif
+
+/* ================= COMPILER ================= */
+
+#if MAX_CODE
+
+// RUN compiles every line into code[]: statement tokens are copied, while
+// each expression is rewritten in postfix form and closed by TOK_EXPR_END,
+// so it can be evaluated by a flat stack machine instead of re-parsing the
+// infix tokens. Constant GOTO and GOSUB targets become TOK_JMP and TOK_CALL
+// + line ordinal.
+// program[] is left untouched for LIST and SAVE. If a program does not
+// fit, RUN falls back to interpreting program[] directly.
+
+static void c_emit(struct basic_ctx *ctx, uint8_t v) {
+    if (ctx->cp < ctx->code + MAX_CODE) *ctx->cp++ = v;
+    else ctx->c_fail = 1;
+}
+
+static void c_push(struct basic_ctx *ctx) {
+    if (++ctx->c_depth > EVAL_STACK) ctx->c_fail = 1;
+    if (ctx->c_depth > ctx->stats[STAT_MAX_DEPTH])
+        ctx->stats[STAT_MAX_DEPTH] = ctx->c_depth;
+}
+
+static void c_emit_num(struct basic_ctx *ctx, int16_t v) {
+    c_emit(ctx, TOK_NUM);
+    c_emit(ctx, v & 0xFF);
+    c_emit(ctx, v >> 8);
+    c_push(ctx);
+}
+
+static void c_expr(struct basic_ctx *ctx, uint8_t **pc);
+
+static void c_copy(struct basic_ctx *ctx, uint8_t **pc) {
+    int n = tok_size(*pc);
+    while (n--) c_emit(ctx, *(*pc)++);
+}
+
+// A string expression is copied as it is, each MID$ up to its closing
+// parenthesis, for sexpr() to read at run time
+static void c_string(struct basic_ctx *ctx, uint8_t **pc) {
+    for (;;) {
+        int depth = 0;
+        if (**pc == TOK_MID) c_copy(ctx, pc);
+        while (**pc != TOK_EOL) {
+            if (**pc == TOK_LPAREN) depth++;
+            else if (**pc == TOK_RPAREN) depth--;
+            c_copy(ctx, pc);
+            if (depth <= 0) break;
+        }
+        if (**pc != TOK_PLUS) break;
+        c_copy(ctx, pc);
+    }
+}
+
+// The c_* parsers mirror factor()/term()/expr()/condition() exactly,
+// emitting code where those evaluate.
+static void c_factor(struct basic_ctx *ctx, uint8_t **pc) {
+    if (is_num(*pc)) {
+        c_emit_num(ctx, num_at(*pc));
+        *pc += tok_size(*pc);
+    }
+    else if (IS_VAR(**pc) && (*pc)[1] == TOK_LPAREN) {
+        uint8_t v = **pc - TOK_VAR;
+        *pc += 2;
+        c_expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+        c_emit(ctx, TOK_INDEX);
+        c_emit(ctx, v);
+    }
+    else if (IS_VAR(**pc)) {
+        c_emit(ctx, TOK_LOAD);
+        c_emit(ctx, *(*pc)++ - TOK_VAR);
+        c_push(ctx);
+    }
+    else if (**pc == TOK_STR) {
+        *pc += 2 + (*pc)[1];
+        c_emit_num(ctx, 0);
+    }
+    else if (**pc == TOK_PEEK) {
+        (*pc)++;
+        if (**pc == TOK_LPAREN) (*pc)++;
+        c_expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+        c_emit(ctx, TOK_PEEK);
+    }
+    else if (**pc == TOK_FRE) {
+        (*pc)++;
+        if (**pc == TOK_LPAREN) (*pc)++;
+        c_expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+        c_emit(ctx, TOK_FRE);
+    }
+    else if (**pc == TOK_LEN) {
+        c_emit(ctx, *(*pc)++);
+        if (**pc == TOK_LPAREN) c_emit(ctx, *(*pc)++);
+        c_string(ctx, pc);
+        if (**pc == TOK_RPAREN) c_emit(ctx, *(*pc)++);
+        c_push(ctx);
+    }
+    else if (**pc == TOK_SVAR || **pc == TOK_MID) {
+        // a string where a number belongs: left for factor() to report
+        ctx->c_fail = 1;
+    }
+    else if (**pc == TOK_LPAREN) {
+        (*pc)++;
+        c_expr(ctx, pc);
+        if (**pc == TOK_RPAREN) (*pc)++;
+    }
+    else {
+        c_emit_num(ctx, 0);
+    }
+}
+
+static void c_term(struct basic_ctx *ctx, uint8_t **pc) {
+    c_factor(ctx, pc);
+    while (**pc == TOK_MUL || **pc == TOK_DIV || **pc == TOK_DIVC) {
+        uint8_t op = *(*pc)++;
+        if (op == TOK_DIVC) {
+            // lowered when the line was entered
+            c_emit(ctx, TOK_DIVC);
+            for (int i = 0; i < 3; i++) c_emit(ctx, *(*pc)++);
+            continue;
+        }
+        if (op == TOK_DIV && is_num(*pc) && num_at(*pc)) {
+            // literal divisor of a LOADed version 2 image
+            uint8_t shift;
+            uint16_t m = divc_magic(num_at(*pc), &shift);
+            *pc += tok_size(*pc);
+            c_emit(ctx, TOK_DIVC);
+            c_emit(ctx, m & 0xFF);
+            c_emit(ctx, m >> 8);
+            c_emit(ctx, shift);
+            continue;
+        }
+        c_factor(ctx, pc);
+        c_emit(ctx, op);
+        ctx->c_depth--;
+    }
+}
+
+static void c_expr(struct basic_ctx *ctx, uint8_t **pc) {
+    if (ctx->expr_depth == EXPR_DEPTH) {
+        // too deep: left for expr() to report
+        ctx->c_fail = 1;
+        return;
+    }
+    ctx->expr_depth++;
+    c_term(ctx, pc);
+    while (**pc == TOK_PLUS || **pc == TOK_MINUS) {
+        uint8_t op = *(*pc)++;
+        c_term(ctx, pc);
+        c_emit(ctx, op);
+        ctx->c_depth--;
+    }
+    ctx->expr_depth--;
+}
+
+static void c_value(struct basic_ctx *ctx, uint8_t **pc) {
+    ctx->c_depth = 0;
+    c_expr(ctx, pc);
+    c_emit(ctx, TOK_EXPR_END);
+}
+
+static void c_condition(struct basic_ctx *ctx, uint8_t **pc) {
+    if (str_start(**pc)) {
+        // left as tokens for str_condition()
+        c_string(ctx, pc);
+        if (**pc != TOK_EOL) c_emit(ctx, *(*pc)++);
+        c_string(ctx, pc);
+        return;
+    }
+
+    ctx->c_depth = 0;
+    c_expr(ctx, pc);
+    uint8_t op = **pc;
+    if (op != TOK_EOL) (*pc)++;
+    c_expr(ctx, pc);
+
+    switch (op) {
+        case TOK_LT: case TOK_GT: case TOK_LE: case TOK_GE:
+        case TOK_NE: case TOK_EQEQ: case TOK_EQ:
+            c_emit(ctx, op);
+            break;
+        default:
+            c_emit_num(ctx, 0);  // not a comparison: always false
+            break;
+    }
+    c_emit(ctx, TOK_EXPR_END);
+}
+
+// Mirrors run_from(); unknown tokens are copied whole so that the
+// executor skips them exactly as it would in program[].
+static void c_statement(struct basic_ctx *ctx, uint8_t **ip) {
+    uint8_t tok = *(*ip)++;
+
+    switch (tok) {
+        case TOK_LET: {
+            uint8_t t = *(*ip)++;
+            c_emit(ctx, TOK_LET);
+            if (IS_VAR(t)) {
+                c_emit(ctx, t);
+                if (**ip == TOK_LPAREN) {
+                    c_emit(ctx, *(*ip)++);
+                    c_value(ctx, ip);
+                    if (**ip == TOK_RPAREN) c_emit(ctx, *(*ip)++);
+                }
+                if (**ip == TOK_EQ) (*ip)++;
+                c_value(ctx, ip);
+            } else if (t == TOK_SVAR) {
+                c_emit(ctx, t);
+                c_emit(ctx, *(*ip)++);
+                if (**ip == TOK_EQ) (*ip)++;
+                c_string(ctx, ip);
+            } else {
+                (*ip)--;
+            }
+            break;
+        }
+
+        case TOK_DIM:
+            c_emit(ctx, TOK_DIM);
+            while (IS_VAR(**ip) && (*ip)[1] == TOK_LPAREN) {
+                c_emit(ctx, *(*ip)++);
+                c_emit(ctx, *(*ip)++);
+                c_value(ctx, ip);
+                if (**ip == TOK_RPAREN) c_emit(ctx, *(*ip)++);
+                if (**ip != TOK_COMMA) break;
+                c_emit(ctx, *(*ip)++);
+            }
+            break;
+
+        case TOK_POKE:
+            c_emit(ctx, TOK_POKE);
+            c_value(ctx, ip);
+            if (**ip == TOK_COMMA) c_emit(ctx, *(*ip)++);
+            c_value(ctx, ip);
+            break;
+
+        case TOK_SLEEP:
+            c_emit(ctx, TOK_SLEEP);
+            c_value(ctx, ip);
+            break;
+
+        case TOK_TASK:
+            c_emit(ctx, TOK_TASK);
+            c_value(ctx, ip);
+            if (**ip == TOK_COMMA) {
+                c_emit(ctx, *(*ip)++);
+                c_value(ctx, ip);
+            }
+            break;
+
+        case TOK_PRINT:
+            c_emit(ctx, TOK_PRINT);
+            if (str_start(**ip)) {
+                c_string(ctx, ip);
+            } else {
+                c_value(ctx, ip);
+            }
+            break;
+
+        case TOK_GOTO:
+        case TOK_GOSUB: {
+            // a lone literal target that exists is resolved now
+            uint8_t *t = *ip;
+            uint8_t after = is_num(t) ? t[tok_size(t)] : TOK_EOL;
+            if (is_num(t) && after != TOK_PLUS && after != TOK_MINUS &&
+                after != TOK_MUL && after != TOK_DIV && after != TOK_DIVC) {
+                uint16_t ln = num_at(t);
+                uint16_t ord = index_search(ctx, ctx->program,
+                                            ctx->line_index, ln);
+                if (ord < ctx->line_count &&
+                    LINE_NUM(ctx->program + ctx->line_index[ord]) == ln) {
+                    c_emit(ctx, tok == TOK_GOTO ? TOK_JMP : TOK_CALL);
+                    c_emit(ctx, ord & 0xFF);
+                    c_emit(ctx, ord >> 8);
+                    *ip += tok_size(t);
+                    break;
+                }
+            }
+            c_emit(ctx, tok);
+            c_value(ctx, ip);
             break;
         }
-            
-        case TOK_SLEEP: {
-            int16_t seconds = expr(ip);
-            if (seconds > 0) {
-                hw_sleep(seconds);
+
+        case TOK_FOR:
+            c_emit(ctx, TOK_FOR);
+            if (IS_VAR(**ip)) {
+                c_emit(ctx, *(*ip)++);
+                if (**ip == TOK_EQ) (*ip)++;
+                c_value(ctx, ip);
+                if (**ip == TOK_TO) {
+                    c_emit(ctx, *(*ip)++);
+                    c_value(ctx, ip);
+                }
+                if (**ip == TOK_STEP) {
+                    c_emit(ctx, *(*ip)++);
+                    c_value(ctx, ip);
+                }
             }
             break;
-        }
-            
-        case TOK_PRINT:
-            if (*(*ip) == TOK_STR) {
-                (*ip)++;
-                uint8_t len = *(*ip)++;
-                print(len, (uint8_t*)*ip);
-                printf("\r\n");
-                *ip += len;
-            } else {
-                printf("%d\r\n", expr(ip));
+
+        case TOK_NEXT:
+            c_emit(ctx, TOK_NEXT);
+            if (IS_VAR(**ip)) c_emit(ctx, *(*ip)++);
+            break;
+
+        case TOK_INPUT:
+            c_emit(ctx, TOK_INPUT);
+            if (**ip == TOK_STR) {
+                uint8_t len = (*ip)[1] + 2;
+                while (len--) c_emit(ctx, *(*ip)++);
+                if (**ip == TOK_COMMA) c_emit(ctx, *(*ip)++);
             }
+            if (IS_VAR(**ip) || **ip == TOK_SVAR) c_copy(ctx, ip);
             break;
-            
-        case TOK_GOTO: {
-            uint8_t *new_pc = find_line(expr(ip));
-            if (new_pc && pc) {
-                *pc = new_pc;
-                return 0; // Don't advance pc
+
+        default:
+            (*ip)--;
+            c_copy(ctx, ip);
+            break;
+    }
+}
+
+// Mirrors the statement loop of run_from(). An IF is followed by the
+// offset of its ELSE (or TOK_EOL) from the start of the line.
+static void c_line(struct basic_ctx *ctx, uint8_t *line, uint8_t *ip) {
+    uint8_t *if_off = NULL;
+    uint8_t *clause = NULL;
+
+    while (*ip != TOK_EOL) {
+        if (*ip == TOK_IF) {
+            c_emit(ctx, *ip++);
+            if_off = ctx->cp;
+            c_emit(ctx, 0);
+            c_condition(ctx, &ip);
+            clause = ctx->cp;
+            while (*ip != TOK_EOL) {
+                // IF, THEN and ELSE inside the clauses are copied as-is
+                if (*ip == TOK_IF || *ip == TOK_THEN || *ip == TOK_ELSE)
+                    c_emit(ctx, *ip++);
+                else
+                    c_statement(ctx, &ip);
             }
             break;
         }
-            
-        case TOK_INPUT: {
-            if (*(*ip) == TOK_STR) {
-                (*ip)++;
-                uint8_t len = *(*ip)++;
-                print(len, (uint8_t*)*ip);
-                *ip += len;
-                if (*(*ip) == TOK_COMMA) (*ip)++;
-            }
-            if (*(*ip) == TOK_VAR) {
-                (*ip)++;
-                current_input_var = *(*ip)++;
-                
-                // Save execution state and request input
-                if (pc) {
-                    execution_pc = *pc + 3 + (*pc)[2];  // Next line
+        c_statement(ctx, &ip);
+    }
+    c_emit(ctx, TOK_EOL);
+
+    if (if_off && !ctx->c_fail) {
+        if (*clause == TOK_THEN) clause++;
+        uint16_t off = find_else(clause) - line;
+        if (off > 255) ctx->c_fail = 1;
+        else *if_off = off;
+    }
+}
+
+static int compile_program(struct basic_ctx *ctx) {
+    if (!ctx->index_ok) return 0;
+
+    ctx->cp = ctx->code;
+    ctx->c_fail = 0;
+    for (uint16_t i = 0; i < ctx->line_count; i++) {
+        uint8_t *src = ctx->program + ctx->line_index[i];
+        uint8_t *line = ctx->cp;
+
+        ctx->code_index[i] = ctx->cp - ctx->code;
+        c_emit(ctx, src[0]);
+        c_emit(ctx, src[1]);
+        c_line(ctx, line, src + LINE_HEADER);
+        if (ctx->c_fail) return 0;
+    }
+
+    ctx->exec_base = ctx->code;
+    ctx->exec_len = ctx->cp - ctx->code;
+    ctx->exec_index = ctx->code_index;
+    return 1;
+}
+
+// Evaluate one compiled expression, leaving *pc after its TOK_EXPR_END
+static int16_t vm_eval(struct basic_ctx *ctx, uint8_t **pc) {
+    int16_t stack[EVAL_STACK];
+    int16_t *sp = stack;
+    uint8_t *ip = *pc;
+
+    stack_mark(ctx);
+#ifdef THREADED
+    static const void *const vm_ops[256] = {
+        [0 ... 255]  = &&op_default,
+        [TOK_NUM]    = &&op_TOK_NUM,
+        [TOK_LOAD]   = &&op_TOK_LOAD,
+        [TOK_INDEX]  = &&op_TOK_INDEX,
+        [TOK_PEEK]   = &&op_TOK_PEEK,
+        [TOK_LEN]    = &&op_TOK_LEN,
+        [TOK_FRE]    = &&op_TOK_FRE,
+        [TOK_PLUS]   = &&op_TOK_PLUS,
+        [TOK_MINUS]  = &&op_TOK_MINUS,
+        [TOK_MUL]    = &&op_TOK_MUL,
+        [TOK_DIV]    = &&op_TOK_DIV,
+        [TOK_DIVC]   = &&op_TOK_DIVC,
+        [TOK_LT]     = &&op_TOK_LT,
+        [TOK_GT]     = &&op_TOK_GT,
+        [TOK_LE]     = &&op_TOK_LE,
+        [TOK_GE]     = &&op_TOK_GE,
+        [TOK_NE]     = &&op_TOK_NE,
+        [TOK_EQ]     = &&op_TOK_EQ,
+        [TOK_EQEQ]   = &&op_TOK_EQEQ,
+    };
+#define NEXT_OP goto *vm_ops[*ip++]
+#else
+#define NEXT_OP continue
+#endif
+
+    for (;;) {
+        DISPATCH(vm_ops, *ip++) {
+            OP(TOK_NUM)
+                *sp++ = ip[0] | (ip[1] << 8);
+                ip += 2;
+                NEXT_OP;
+            OP(TOK_LOAD)
+                *sp++ = ctx->vars[*ip++];
+                NEXT_OP;
+            OP(TOK_INDEX) {
+                int16_t *cell = element(ctx, *ip++, sp[-1]);
+                sp[-1] = cell ? *cell : 0;
+                NEXT_OP;
+            }
+            OP(TOK_PEEK)
+                sp[-1] = peek(ctx, sp[-1] & 0xff);
+                NEXT_OP;
+            OP(TOK_LEN)
+                *sp++ = str_length(ctx, &ip);
+                NEXT_OP;
+            OP(TOK_FRE)
+                sp[-1] = fre(ctx, sp[-1]);
+                NEXT_OP;
+            OP(TOK_PLUS)  sp--; sp[-1] += sp[0]; NEXT_OP;
+            OP(TOK_MINUS) sp--; sp[-1] -= sp[0]; NEXT_OP;
+            OP(TOK_MUL)   sp--; sp[-1] = MUL16(sp[-1], sp[0]); NEXT_OP;
+            OP(TOK_DIV)   sp--; if (sp[0]) sp[-1] = DIV16(sp[-1], sp[0]); NEXT_OP;
+            OP(TOK_DIVC)
+                sp[-1] = divc(sp[-1], ip[0] | (ip[1] << 8), ip[2]);
+                ip += 3;
+                NEXT_OP;
+            OP(TOK_LT)    sp--; sp[-1] = sp[-1] < sp[0]; NEXT_OP;
+            OP(TOK_GT)    sp--; sp[-1] = sp[-1] > sp[0]; NEXT_OP;
+            OP(TOK_LE)    sp--; sp[-1] = sp[-1] <= sp[0]; NEXT_OP;
+            OP(TOK_GE)    sp--; sp[-1] = sp[-1] >= sp[0]; NEXT_OP;
+            OP(TOK_NE)    sp--; sp[-1] = sp[-1] != sp[0]; NEXT_OP;
+            OP(TOK_EQ)
+            OP(TOK_EQEQ)  sp--; sp[-1] = sp[-1] == sp[0]; NEXT_OP;
+            OP_DEFAULT    // TOK_EXPR_END
+                *pc = ip;
+                return sp[-1];
+        }
+    }
+}
+
+#endif
+
+// Expression and condition entry points for the statement executor
+static int16_t eval(struct basic_ctx *ctx, uint8_t **pc) {
+#if MAX_CODE
+    if (ctx->exec_base == ctx->code) return vm_eval(ctx, pc);
+#endif
+    return expr(ctx, pc);
+}
+
+static int eval_condition(struct basic_ctx *ctx, uint8_t **pc) {
+#if MAX_CODE
+    if (ctx->exec_base == ctx->code && !str_start(**pc))
+        return vm_eval(ctx, pc);
+#endif
+    return condition(ctx, pc);
+}
+
+/* ================= EXECUTION ================= */
+
+#define INPUT_STRING 0x80   // current_input_var is a string variable
+
+// Handler for INPUT statement response
+static void handle_input_response(struct basic_ctx *ctx, uint8_t *line) {
+    // Back to command mode before resuming, so a further INPUT can
+    // request the next value
+    uint8_t *pc = ctx->execution_pc;
+    ctx->execution_pc = NULL;
+    ctx->current_input_mode = INPUT_MODE_COMMAND;
+
+    if (ctx->current_input_var & INPUT_STRING) {
+        str_input(ctx, ctx->current_input_var & ~INPUT_STRING, line);
+        if (ctx->fault) {
+            // The program stops, as it would at the INPUT itself
+            out_str(ctx, "Error: ");
+            out_str(ctx, ctx->fault);
+            out_str(ctx, "\r\n");
+            ctx->fault = NULL;
+            return;
+        }
+    } else {
+        // Parse the input value
+        int val = atoi((char*)line);
+        ctx->vars[ctx->current_input_var] = val;
+    }
+
+    // Resume execution from where we left off
+    if (pc) {
+        struct resume at = { pc };
+        run_from(ctx, &at);
+    }
+}
+
+static void request_input(struct basic_ctx *ctx) {
+    ctx->current_input_mode = INPUT_MODE_AWAITING_INPUT;
+#ifdef TARGET_LINUX
+    if (!ctx->batch_mode)
+#endif
+    out_str(ctx, "? ");
+    out_flush(ctx);
+}
+
+// Stop the program with a message naming the line
+static void run_error(struct basic_ctx *ctx, const char *msg, uint8_t *pc) {
+    out_str(ctx, "Error: ");
+    out_str(ctx, msg);
+    out_str(ctx, " in line ");
+    out_uint(ctx, LINE_NUM(pc));
+    out_str(ctx, "\r\n");
+}
+
+/* ================= MAIN EXECUTION LOOP ================= */
+
+/* ================= TASKS ================= */
+
+// The program RUN starts is task 0; TASK n, line starts task n (1 to
+// MAX_TASKS - 1) at a line, and TASK n stops it. Tasks share program[],
+// the variables and the arrays: each has only its own position and FOR
+// and GOSUB stacks. They take turns every TASK_SLICE statements and when
+// one SLEEPs, so a switch saves the position and swaps the stack pointers.
+// A task ends at END or after the last line; the program ends with the
+// last task. INPUT and errors concern the whole program. Built with
+// MAX_TASKS=1 there is only task 0, and TASK stops the program.
+#define NO_TASK 0xFF
+
+enum {
+    TASK_FREE,
+    TASK_READY,
+    TASK_SLEEPING
+};
+
+static void task_save(struct basic_ctx *ctx, const struct resume *at) {
+    ctx->tasks[ctx->cur_task].at = *at;
+    ctx->tasks[ctx->cur_task].for_sp = ctx->for_sp;
+    ctx->tasks[ctx->cur_task].gosub_sp = ctx->gosub_sp;
+}
+
+static void task_load(struct basic_ctx *ctx, uint8_t n) {
+    ctx->cur_task = n;
+    ctx->for_stack = ctx->tasks[n].fors;
+    ctx->for_sp = ctx->tasks[n].for_sp;
+    ctx->gosub_stack = ctx->tasks[n].gosubs;
+    ctx->gosub_sp = ctx->tasks[n].gosub_sp;
+}
+
+static void task_set(struct basic_ctx *ctx, uint8_t n, uint8_t state) {
+    if (ctx->tasks[n].state == TASK_READY) ctx->tasks_ready--;
+    if (ctx->tasks[n].state == TASK_SLEEPING) ctx->tasks_sleeping--;
+    ctx->tasks[n].state = state;
+    if (state == TASK_READY) ctx->tasks_ready++;
+    if (state == TASK_SLEEPING) ctx->tasks_sleeping++;
+}
+
+static void tasks_reset(struct basic_ctx *ctx) {
+    for (uint8_t n = 0; n < MAX_TASKS; n++) ctx->tasks[n].state = TASK_FREE;
+    ctx->tasks_ready = ctx->tasks_sleeping = 0;
+    task_set(ctx, 0, TASK_READY);
+    ctx->tasks[0].for_sp = ctx->tasks[0].gosub_sp = 0;
+    task_load(ctx, 0);
+}
+
+// The next READY task after the current one, the current one last
+static uint8_t task_next(struct basic_ctx *ctx) {
+    uint8_t n = ctx->cur_task;
+
+    for (uint8_t i = 0; i < MAX_TASKS; i++) {
+        if (++n == MAX_TASKS) n = 0;
+        if (ctx->tasks[n].state == TASK_READY) return n;
+    }
+    return NO_TASK;
+}
+
+// Make sleeping tasks whose time is up READY. Counting a second at a time
+// keeps long sleeps clear of the 32-bit microsecond tick wrapping.
+static void tasks_wake(struct basic_ctx *ctx) {
+    uint32_t now = hw_ticks();
+
+    for (uint8_t n = 0; n < MAX_TASKS; n++) {
+        struct task *t = &ctx->tasks[n];
+        if (t->state != TASK_SLEEPING) continue;
+        while (t->sleep_secs && now - t->sleep_mark >= 1000000) {
+            t->sleep_mark += 1000000;
+            t->sleep_secs--;
+        }
+        if (!t->sleep_secs) task_set(ctx, n, TASK_READY);
+    }
+}
+
+#ifdef HIBERNATE_ADDR
+static void hibernate(struct basic_ctx *ctx, const struct resume *at);
+#endif
+
+/* Execution slices (see basic_step()) */
+#define SLICE_CHECK 64              // statements between deadline checks
+
+static void slice_start(struct basic_ctx *ctx) {
+    ctx->slice_left = 0;
+    ctx->task_turn = 0;
+    ctx->slice_quota = ctx->slice_max;
+    ctx->slice_deadline = hw_ticks() + ctx->slice_us;
+}
+
+// Called in place of a statement when slice_left runs out: is the slice
+// over, or how many statements (counting this one) until the next check?
+// With other tasks about, checks come every TASK_SLICE statements, and a
+// check after a full turn sets task_switch and ends the turn instead.
+static int slice_over(struct basic_ctx *ctx) {
+    ctx->task_switch = 0;
+    if (ctx->slice_us && (int32_t)(hw_ticks() - ctx->slice_deadline) >= 0)
+        return 1;
+    if (ctx->slice_max && !ctx->slice_quota) return 1;
+
+    if (ctx->tasks_sleeping) tasks_wake(ctx);
+    ctx->task_switch = ctx->task_turn && ctx->tasks_ready > 1;
+    ctx->task_turn = ctx->tasks_ready + ctx->tasks_sleeping > 1;
+
+    uint32_t n = ctx->slice_us ? SLICE_CHECK : UINT32_MAX;
+    if (ctx->task_turn && n > TASK_SLICE) n = TASK_SLICE;
+    if (ctx->slice_max) {
+        if (n > ctx->slice_quota) n = ctx->slice_quota;
+        ctx->slice_quota -= n;
+    }
+    ctx->slice_left = n - 1;
+    return ctx->task_switch;
+}
+
+#if MAX_TASKS > 1
+// Bring the next check within TASK_SLICE statements, once there is
+// another task to take turns with
+static void slice_shorten(struct basic_ctx *ctx) {
+    if (ctx->slice_left > TASK_SLICE) {
+        if (ctx->slice_max) ctx->slice_quota += ctx->slice_left - TASK_SLICE;
+        ctx->slice_left = TASK_SLICE;
+    }
+    ctx->task_turn = 1;
+}
+#endif
+
+static void run_from(struct basic_ctx *ctx, const struct resume *at) {
+#if LINE_CACHE
+    struct resume from = *at;
+    RESUME(&from);
+    at = &from;
+#endif
+    uint8_t *pc = at->pc;
+    uint8_t *store_end = ctx->exec_base + ctx->exec_len;
+    uint8_t *ip;
+    uint8_t *end;       // statements run while ip < end and *ip != TOK_EOL
+    uint8_t in_if;
+    uint8_t *target;    // GOSUB destination
+#ifdef THREADED
+    static const void *const stmt_ops[256] = {
+        [0 ... 255] = &&op_default,
+        [TOK_LET]   = &&op_TOK_LET,
+        [TOK_POKE]  = &&op_TOK_POKE,
+        [TOK_SLEEP] = &&op_TOK_SLEEP,
+        [TOK_TASK]  = &&op_TOK_TASK,
+        [TOK_PRINT] = &&op_TOK_PRINT,
+        [TOK_GOTO]  = &&op_TOK_GOTO,
+        [TOK_JMP]   = &&op_TOK_JMP,
+        [TOK_INPUT] = &&op_TOK_INPUT,
+        [TOK_END]   = &&op_TOK_END,
+        [TOK_IF]    = &&op_TOK_IF,
+        [TOK_FOR]   = &&op_TOK_FOR,
+        [TOK_NEXT]  = &&op_TOK_NEXT,
+        [TOK_GOSUB] = &&op_TOK_GOSUB,
+        [TOK_CALL]  = &&op_TOK_CALL,
+        [TOK_RETURN] = &&op_TOK_RETURN,
+        [TOK_DIM]   = &&op_TOK_DIM,
+#ifdef HIBERNATE_ADDR
+        [TOK_HIBERNATE] = &&op_TOK_HIBERNATE,
+#endif
+    };
+#define NEXT_STATEMENT \
+    do { \
+        if (ip < end && *ip != TOK_EOL) { \
+            if (ctx->slice_left-- == 0 && slice_over(ctx)) goto slice_end; \
+            ctx->stats[STAT_STATEMENTS]++; \
+            goto *stmt_ops[*ip++]; \
+        } \
+        goto next_statement; \
+    } while (0)
+#else
+#define NEXT_STATEMENT goto next_statement
+#endif
+
+    slice_start(ctx);
+    if (at->ip) {
+        ip = at->ip;
+        end = at->end;
+        in_if = at->in_if;
+        PIN(pc);
+        goto next_statement;
+    }
+
+new_line:
+    if (pc >= store_end) goto end_task;
+    PIN(pc);
+    PROF_LINE(pc);
+    ctx->stats[STAT_LINES_RUN]++;
+    ip = pc + LINE_HEADER;
+    end = store_end;
+    in_if = 0;
+
+next_statement:
+    if (ip >= end || *ip == TOK_EOL) {
+#if LINE_CACHE
+        if (FROM_FILE(ctx)) {
+            pc = cache_next(ctx, pc);
+            goto new_line;
+        }
+#endif
+        pc = *ip == TOK_EOL ? ip + 1 : line_end(ip);
+        goto new_line;
+    }
+
+    if (ctx->slice_left-- == 0 && slice_over(ctx)) goto slice_end;
+    ctx->stats[STAT_STATEMENTS]++;
+    DISPATCH(stmt_ops, *ip++) {
+        OP(TOK_LET)
+            if (*ip == TOK_SVAR) {
+                uint8_t v = ip[1];
+                ip += 2;
+                if (*ip == TOK_EQ) ip++;
+                str_let(ctx, v, &ip);
+                if (ctx->fault) goto fail;
+            }
+            else if (IS_VAR(*ip)) {
+                uint8_t v = *ip++ - TOK_VAR;
+                int16_t *dest = &ctx->vars[v];
+                if (*ip == TOK_LPAREN) {
+                    ip++;
+                    dest = element(ctx, v, eval(ctx, &ip));
+                    if (*ip == TOK_RPAREN) ip++;
+                    if (!dest) goto fail;
                 }
-                request_input();
-                return -1; // Stop execution to wait for input
+                if (*ip == TOK_EQ) ip++;
+                *dest = eval(ctx, &ip);
+                if (ctx->fault) goto fail;
             }
-            break;
+            NEXT_STATEMENT;
+
+        OP(TOK_DIM)
+            while (IS_VAR(*ip) && ip[1] == TOK_LPAREN) {
+                uint8_t v = *ip - TOK_VAR;
+                ip += 2;
+                int16_t n = eval(ctx, &ip);
+                if (*ip == TOK_RPAREN) ip++;
+                if (!ctx->fault) dim(ctx, v, n);
+                if (ctx->fault) goto fail;
+                if (*ip != TOK_COMMA) break;
+                ip++;
+            }
+            NEXT_STATEMENT;
+
+        OP(TOK_POKE) {
+            int16_t addr = eval(ctx, &ip);
+            if (*ip == TOK_COMMA) ip++;
+            int16_t val = eval(ctx, &ip);
+            if (ctx->fault) goto fail;
+            ctx->stats[STAT_POKES]++;
+            out_flush(ctx);
+            if (ctx->poke) ctx->poke(ctx->user, addr & 0xff, val & 0xff);
+            else hw_poke(addr & 0xff, val & 0xff);
+            NEXT_STATEMENT;
         }
-            
-        case TOK_END:
-            return -1; // Stop execution
-            
-        default:
+
+        OP(TOK_SLEEP) {
+            int16_t seconds = eval(ctx, &ip);
+            if (ctx->fault) goto fail;
+            if (seconds > 0) {
+                // Let the other tasks run, or hand control back to the
+                // target until basic_poll() finds the time is up
+                struct resume here = { pc, ip, end, in_if };
+                task_save(ctx, &here);
+                ctx->tasks[ctx->cur_task].sleep_secs = seconds;
+                ctx->tasks[ctx->cur_task].sleep_mark = hw_ticks();
+                task_set(ctx, ctx->cur_task, TASK_SLEEPING);
+                goto next_task;
+            }
+            NEXT_STATEMENT;
+        }
+
+        OP(TOK_TASK) {
+#if MAX_TASKS > 1
+            int16_t n = eval(ctx, &ip);
+            int16_t line = 0;
+            uint8_t start = *ip == TOK_COMMA;
+            if (start) {
+                ip++;
+                line = eval(ctx, &ip);
+            }
+            if (ctx->fault) goto fail;
+            if (n < 1 || n >= MAX_TASKS || n == ctx->cur_task) {
+                ctx->fault = "Bad task number";
+                goto fail;
+            }
+            task_set(ctx, n, TASK_FREE);
+            if (start) {
+                uint8_t *new_pc = find_line(ctx, line);
+                if (!new_pc) {
+                    ctx->fault = "Undefined line";
+                    goto fail;
+                }
+                ctx->tasks[n].at = (struct resume){ new_pc };
+                ctx->tasks[n].for_sp = ctx->tasks[n].gosub_sp = 0;
+                task_set(ctx, n, TASK_READY);
+                slice_shorten(ctx);
+            }
+            NEXT_STATEMENT;
+#else
+            ctx->fault = "No tasks";
+            goto fail;
+#endif
+        }
+
+        OP(TOK_PRINT)
+            if (*ip == TOK_STR && ip[2 + ip[1]] != TOK_PLUS) {
+                // a lone literal is printed from where it is
+                ip++;
+                uint8_t len = *ip++;
+                print(ctx, len, ip);
+                ip += len;
+            } else if (str_start(*ip)) {
+                str_print(ctx, &ip);
+                if (ctx->fault) goto fail;
+            } else {
+                int16_t v = eval(ctx, &ip);
+                if (ctx->fault) goto fail;
+                out_int(ctx, v);
+            }
+            out_str(ctx, "\r\n");
+            NEXT_STATEMENT;
+
+        OP(TOK_GOTO) {
+            int16_t line = eval(ctx, &ip);
+            if (ctx->fault) goto fail;
+            uint8_t *new_pc = find_line(ctx, line);
+            if (new_pc) {
+                PROF_GOTO(new_pc);
+                pc = new_pc;
+                goto new_line;
+            }
+            NEXT_STATEMENT;
+        }
+
+        OP(TOK_JMP)
+            pc = ctx->exec_base + ctx->exec_index[ip[0] | (ip[1] << 8)];
+            PROF_GOTO(pc);
+            goto new_line;
+
+        OP(TOK_INPUT)
+            if (*ip == TOK_STR) {
+                ip++;
+                uint8_t len = *ip++;
+                print(ctx, len, ip);
+                ip += len;
+                if (*ip == TOK_COMMA) ip++;
+            }
+            if (IS_VAR(*ip) || *ip == TOK_SVAR) {
+                if (*ip == TOK_SVAR)
+                    ctx->current_input_var = ip[1] | INPUT_STRING;
+                else
+                    ctx->current_input_var = *ip - TOK_VAR;
+                ip += tok_size(ip);
+
+                // Save execution state and request input
+                ctx->execution_pc = line_end(ip);  // Next line
+#if LINE_CACHE
+                if (FROM_FILE(ctx)) ctx->execution_pc = cache_next(ctx, pc);
+#endif
+                request_input(ctx);
+                PROF_STOP();
+                return; // Stop execution to wait for input
+            }
+            NEXT_STATEMENT;
+
+        OP(TOK_END)
+            goto end_task;
+
+        OP(TOK_GOSUB) {
+            int16_t line = eval(ctx, &ip);
+            if (ctx->fault) goto fail;
+            uint8_t *new_pc = find_line(ctx, line);
+            if (!new_pc) NEXT_STATEMENT;
+            target = new_pc;
+            goto gosub;
+        }
+
+        OP(TOK_CALL)
+            target = ctx->exec_base + ctx->exec_index[ip[0] | (ip[1] << 8)];
+            ip += 2;
+        gosub:
+            if (ctx->gosub_sp == GOSUB_DEPTH) {
+                ctx->fault = "GOSUB nested too deeply";
+                goto fail;
+            }
+            ctx->gosub_stack[ctx->gosub_sp++] = (struct resume){ pc, ip, end, in_if };
+            PROF_GOTO(target);
+            pc = target;
+            goto new_line;
+
+        OP(TOK_RETURN)
+            if (ctx->gosub_sp == 0) {
+                ctx->fault = "RETURN without GOSUB";
+                goto fail;
+            }
+            ctx->gosub_sp--;
+            RESUME(&ctx->gosub_stack[ctx->gosub_sp]);
+            pc = ctx->gosub_stack[ctx->gosub_sp].pc;
+            ip = ctx->gosub_stack[ctx->gosub_sp].ip;
+            end = ctx->gosub_stack[ctx->gosub_sp].end;
+            in_if = ctx->gosub_stack[ctx->gosub_sp].in_if;
+            PIN(pc);
+            NEXT_STATEMENT;
+
+        OP(TOK_FOR) {
+            if (!IS_VAR(*ip)) NEXT_STATEMENT;
+            uint8_t v = *ip++ - TOK_VAR;
+            if (*ip == TOK_EQ) ip++;
+            ctx->vars[v] = eval(ctx, &ip);
+            int16_t limit = ctx->vars[v];
+            int16_t step = 1;
+            if (*ip == TOK_TO) {
+                ip++;
+                limit = eval(ctx, &ip);
+            }
+            if (*ip == TOK_STEP) {
+                ip++;
+                step = eval(ctx, &ip);
+            }
+            if (ctx->fault) goto fail;
+
+            // Re-entering a loop (e.g. after leaving it with GOTO)
+            // drops it and any loops inside it
+            uint8_t i = ctx->for_sp;
+            while (i > 0 && ctx->for_stack[i - 1].var != v) i--;
+            if (i > 0) ctx->for_sp = i - 1;
+
+            if (ctx->for_sp == FOR_DEPTH) {
+                ctx->fault = "FOR nested too deeply";
+                goto fail;
+            }
+            struct for_loop *f = &ctx->for_stack[ctx->for_sp++];
+            f->var = v;
+            f->limit = limit;
+            f->step = step;
+            f->body = (struct resume){ pc, ip, end, in_if };
+            NEXT_STATEMENT;
+        }
+
+        OP(TOK_NEXT) {
+            // NEXT V also closes any loops inside V's
+            if (IS_VAR(*ip)) {
+                uint8_t v = *ip++ - TOK_VAR;
+                while (ctx->for_sp > 0 &&
+                       ctx->for_stack[ctx->for_sp - 1].var != v)
+                    ctx->for_sp--;
+            }
+            if (ctx->for_sp == 0) {
+                ctx->fault = "NEXT without FOR";
+                goto fail;
+            }
+
+            struct for_loop *f = &ctx->for_stack[ctx->for_sp - 1];
+            int32_t value = ctx->vars[f->var] + f->step;
+            ctx->vars[f->var] = value;
+            if (f->step >= 0 ? value <= f->limit : value >= f->limit) {
+                RESUME(&f->body);
+                pc = f->body.pc;
+                ip = f->body.ip;
+                end = f->body.end;
+                in_if = f->body.in_if;
+                PIN(pc);
+            } else {
+                ctx->for_sp--;
+            }
+            NEXT_STATEMENT;
+        }
+
+        OP(TOK_IF) {
+            // IFs inside a THEN or ELSE clause are skipped
+            if (in_if) NEXT_STATEMENT;
+            in_if = 1;
+
+            uint8_t *site = ip - 1;
+            uint8_t *else_pos = NULL;
+#if MAX_CODE
+            if (ctx->exec_base == ctx->code) else_pos = pc + *ip++;
+#endif
+            int cond = eval_condition(ctx, &ip);
+            if (ctx->fault) goto fail;
+            if (*ip == TOK_THEN) ip++;
+            if (!else_pos) else_pos = cached_else(ctx, site, ip);
+
+            // THEN clause runs up to the ELSE, ELSE clause to the EOL;
+            // either way the line is finished afterwards
+            end = else_pos;
+            if (!cond) {
+                ip = else_pos;
+                if (*ip == TOK_ELSE) ip++;
+                end = store_end;
+            }
+            NEXT_STATEMENT;
+        }
+
+#ifdef HIBERNATE_ADDR
+        OP(TOK_HIBERNATE) {
+            struct resume here = { pc, ip, end, in_if };
+            hibernate(ctx, &here);
+            if (ctx->fault) goto fail;
+            NEXT_STATEMENT;
+        }
+#endif
+
+        OP_DEFAULT
             // Unknown token, skip it
-            break;
+            ip += tok_size(ip - 1) - 1;
+            NEXT_STATEMENT;
+    }
+
+fail:
+    run_error(ctx, ctx->fault, pc);
+    ctx->fault = NULL;
+    str_pop(ctx, 0);
+    PROF_STOP();
+    return;
+
+end_task:
+    task_set(ctx, ctx->cur_task, TASK_FREE);
+
+next_task: {
+    // The current task has ended, gone to sleep or had its turn
+    uint8_t n = task_next(ctx);
+    if (n == NO_TASK) {
+        if (ctx->tasks_sleeping) ctx->current_input_mode = INPUT_MODE_SLEEPING;
+        PROF_STOP();
+        return;
+    }
+    task_load(ctx, n);
+    RESUME(&ctx->tasks[n].at);
+    pc = ctx->tasks[n].at.pc;
+    if (!ctx->tasks[n].at.ip) goto new_line;
+    ip = ctx->tasks[n].at.ip;
+    end = ctx->tasks[n].at.end;
+    in_if = ctx->tasks[n].at.in_if;
+    PIN(pc);
+    goto next_statement;
+}
+
+slice_end:
+    if (ctx->task_switch) {
+        struct resume here = { pc, ip, end, in_if };
+        task_save(ctx, &here);
+        goto next_task;
+    }
+
+    // Out of time or statements: carry on at this statement next slice
+    ctx->step_at = (struct resume){ pc, ip, end, in_if };
+    ctx->current_input_mode = INPUT_MODE_RUNNING;
+    PROF_STOP();
+}
+
+// Start the program in the exec store at its first line, pc
+static void run_start(struct basic_ctx *ctx, uint8_t *pc) {
+    PROF_RESET();
+    tasks_reset(ctx);
+    reset_arrays(ctx);
+    str_reset(ctx);
+
+    struct resume start = { pc };
+    run_from(ctx, &start);
+}
+
+static void run(struct basic_ctx *ctx) {
+    close_gap(ctx);
+    index_program(ctx);
+#if MAX_CODE
+    compile_program(ctx);
+#endif
+    run_start(ctx, ctx->exec_base);
+}
+
+#if LINE_CACHE
+// RUN name: the file must be a SAVEd image in the current format
+static void run_file(struct basic_ctx *ctx, const char *filename) {
+    uint32_t addr;
+    uint16_t len;
+
+    out_flush(ctx);
+    if (hw_open(filename, &addr, &len) != 0 || len < IMAGE_TRAILER ||
+        fram_read(addr + len - 2) != IMAGE_TAG ||
+        !IMAGE_OK(fram_read(addr + len - 1))) {
+        out_str(ctx, "Error running ");
+        out_str(ctx, filename);
+        out_str(ctx, "\r\n");
+        return;
+    }
+
+    ctx->file_addr = addr;
+    ctx->file_len = len - IMAGE_TRAILER;
+    if (!file_index(ctx)) {
+        out_str(ctx, "Bad program in ");
+        out_str(ctx, filename);
+        out_str(ctx, "\r\n");
+        index_program(ctx);
+        return;
+    }
+
+    memset(ctx->cache_tag, 0, sizeof(ctx->cache_tag));
+    ctx->cache_clock = 0;
+    ctx->cache_pin = NULL;
+    ctx->exec_base = ctx->cache[0];
+    ctx->exec_len = sizeof(ctx->cache);
+    goto_cache_clear(ctx);
+    run_start(ctx, ctx->file_len ? cache_line(ctx, 0) : ctx->cache[LINE_CACHE]);
+}
+#endif
+
+/* ================= HIBERNATE ================= */
+
+// Built with -DHIBERNATE_ADDR, HIBERNATE writes the tokenized program, the
+// variables and arrays, the FOR and GOSUB stacks and the position after the
+// statement to HIBERNATE_SIZE bytes of F-RAM at HIBERNATE_ADDR, which the
+// filesystem must leave alone. After a reset basic_resume() reads it back
+// and carries on from there. Positions are kept as offsets into the exec
+// store, which is rebuilt from program[] exactly as RUN builds it.
+//
+// The region starts with a header: magic, body length and a checksum of
+// the body. The magic is cleared before the body is written and set last,
+// so an interrupted write leaves no snapshot.
+#ifdef HIBERNATE_ADDR
+
+#ifndef HIBERNATE_SIZE
+#define HIBERNATE_SIZE 2048
+#endif
+
+#define SNAP_MAGIC  0x4844      // "DH"; "CH" snapshots used the wider tokens
+#define SNAP_HEADER 6
+
+enum {
+    SNAP_STOPPED,       // program, variables and arrays only
+    SNAP_RUNNING        // and the stacks and position to carry on at
+};
+
+uint8_t fram_read(int addr);
+void fram_write(int addr, unsigned char d);
+void fram_write_enable(void);
+
+static void snap_begin(struct basic_ctx *ctx) {
+    ctx->snap_pos = 0;
+    ctx->snap_sum = 0;
+    ctx->snap_fail = 0;
+}
+
+static void snap_add(struct basic_ctx *ctx, uint8_t b) {
+    ctx->snap_sum = ((ctx->snap_sum << 1) | (ctx->snap_sum >> 15)) + b;
+}
+
+static void snap_put(struct basic_ctx *ctx, const void *data, uint16_t len) {
+    const uint8_t *p = data;
+
+    if (ctx->snap_pos + len > HIBERNATE_SIZE - SNAP_HEADER) {
+        ctx->snap_fail = 1;
+        return;
+    }
+    while (len--) {
+        snap_add(ctx, *p);
+        fram_write(HIBERNATE_ADDR + SNAP_HEADER + ctx->snap_pos++, *p++);
+    }
+}
+
+// With data NULL the bytes are only checksummed
+static void snap_get(struct basic_ctx *ctx, void *data, uint16_t len,
+                     uint16_t body_len) {
+    uint8_t *p = data;
+
+    if (ctx->snap_pos + len > body_len) {
+        ctx->snap_fail = 1;
+        return;
+    }
+    while (len--) {
+        uint8_t b = fram_read(HIBERNATE_ADDR + SNAP_HEADER + ctx->snap_pos++);
+        snap_add(ctx, b);
+        if (p) *p++ = b;
+    }
+}
+
+static void snap_put16(struct basic_ctx *ctx, uint16_t v) {
+    uint8_t b[2] = { v & 0xFF, v >> 8 };
+    snap_put(ctx, b, 2);
+}
+
+static void snap_put_pos(struct basic_ctx *ctx, const uint8_t *p) {
+    snap_put16(ctx, p ? p - ctx->exec_base : NO_LINE);
+}
+
+static void snap_put_resume(struct basic_ctx *ctx, const struct resume *r) {
+    snap_put_pos(ctx, r->pc);
+    snap_put_pos(ctx, r->ip);
+    snap_put_pos(ctx, r->end);
+    snap_put(ctx, &r->in_if, 1);
+}
+
+static void snap_header(uint16_t magic, uint16_t len, uint16_t sum) {
+    uint8_t h[SNAP_HEADER] = {
+        magic & 0xFF, magic >> 8, len & 0xFF, len >> 8, sum & 0xFF, sum >> 8
+    };
+
+    fram_write_enable();
+    for (uint8_t i = 0; i < SNAP_HEADER; i++)
+        fram_write(HIBERNATE_ADDR + i, h[i]);
+}
+
+// Write a snapshot; at is where to carry on, or NULL for a stopped
+// program. Returns the body length, or 0 with a fault if it does not fit.
+static uint16_t snapshot(struct basic_ctx *ctx, const struct resume *at) {
+    uint8_t state = at ? SNAP_RUNNING : SNAP_STOPPED;
+    uint8_t compiled = at && ctx->exec_base != ctx->program;
+    uint8_t for_depth = at ? ctx->for_sp : 0;
+    uint8_t gosub_depth = at ? ctx->gosub_sp : 0;
+
+    out_flush(ctx);
+    snap_header(0, 0, 0);
+    snap_begin(ctx);
+
+    snap_put(ctx, &compiled, 1);
+    snap_put16(ctx, ctx->prog_len);
+    snap_put(ctx, ctx->program, ctx->prog_len);
+    snap_put(ctx, ctx->vars, sizeof(ctx->vars));
+
+#if ARRAY_CELLS
+    snap_put16(ctx, ctx->arena_top);
+    snap_put(ctx, ctx->arrays, sizeof(ctx->arrays));
+    snap_put(ctx, ctx->arena, ctx->arena_top * sizeof(int16_t));
+#endif
+
+#if STRING_ARENA
+    // Compacted first, so only live bytes are written
+    str_collect(ctx);
+    snap_put16(ctx, ctx->str_top);
+    snap_put(ctx, ctx->strs, NUM_VARS * sizeof(ctx->strs[0]));
+    snap_put(ctx, ctx->str_arena, ctx->str_top);
+#endif
+
+    snap_put(ctx, &for_depth, 1);
+    for (uint8_t i = 0; i < for_depth; i++) {
+        snap_put(ctx, &ctx->for_stack[i].var, 1);
+        snap_put16(ctx, ctx->for_stack[i].limit);
+        snap_put16(ctx, ctx->for_stack[i].step);
+        snap_put_resume(ctx, &ctx->for_stack[i].body);
     }
-    
-    return 1; // Continue normally
+    snap_put(ctx, &gosub_depth, 1);
+    for (uint8_t i = 0; i < gosub_depth; i++)
+        snap_put_resume(ctx, &ctx->gosub_stack[i]);
+
+    snap_put(ctx, &state, 1);
+    if (at) snap_put_resume(ctx, at);
+
+    if (ctx->snap_fail) {
+        ctx->fault = "Snapshot too large";
+        return 0;
+    }
+    snap_header(SNAP_MAGIC, ctx->snap_pos, ctx->snap_sum);
+    return ctx->snap_pos;
 }
 
-/* ================= MAIN EXECUTION LOOP ================= */
+static void hibernate(struct basic_ctx *ctx, const struct resume *at) {
+#if LINE_CACHE
+    if (FROM_FILE(ctx)) {
+        ctx->fault = "Can't HIBERNATE a program run from a file";
+        return;
+    }
+#endif
+    snapshot(ctx, at);
+}
 
-static void run_from(uint8_t *start_pc) {
-    uint8_t *pc = start_pc;
+static uint16_t snap_get16(struct basic_ctx *ctx, uint16_t body_len) {
+    uint8_t b[2] = { 0, 0 };
+    snap_get(ctx, b, 2, body_len);
+    return b[0] | (b[1] << 8);
+}
 
-    while (pc < program + prog_len) {
-        uint8_t *ip = pc + 3;
-        int should_advance = 1;
+static uint8_t *snap_get_pos(struct basic_ctx *ctx, uint16_t body_len) {
+    uint16_t off = snap_get16(ctx, body_len);
+    if (off == NO_LINE) return NULL;
+    if (off > ctx->exec_len) ctx->snap_fail = 1;
+    return ctx->exec_base + off;
+}
 
-        while (*ip != TOK_EOL) {
-            uint8_t tok = *ip;
-            
-            if (tok == TOK_IF) {
-                ip++;
-                int cond = condition(&ip);
-                if (*ip == TOK_THEN) ip++;
-                
-                if (cond) {
-                    // Execute the THEN part
-                    uint8_t *else_pos = ip;
-                    int depth = 0;
-                    
-                    // Find ELSE at same depth
-                    while (*else_pos != TOK_EOL) {
-                        if (*else_pos == TOK_IF) depth++;
-                        else if (*else_pos == TOK_ELSE && depth == 0) break;
-                        else if (*else_pos == TOK_NUM) else_pos += 2;
-                        else if (*else_pos == TOK_STR) {
-                            else_pos++;
-                            else_pos += *else_pos + 1;
-                            continue;
-                        }
-                        else if (*else_pos == TOK_VAR) else_pos++;
-                        else_pos++;
-                    }
-                    
-                    // Execute THEN clause
-                    while (ip < else_pos && *ip != TOK_EOL) {
-                        int result = execute_statement(&ip, &pc);
-                        if (result == 0) {
-                            should_advance = 0;
-                            break;
-                        } else if (result == -1) {
-                            return;
-                        }
-                    }
-                } else {
-                    // Skip to ELSE or EOL
-                    int depth = 0;
-                    while (*ip != TOK_EOL) {
-                        if (*ip == TOK_IF) depth++;
-                        else if (*ip == TOK_ELSE && depth == 0) {
-                            ip++;
-                            break;
-                        }
-                        if (*ip == TOK_NUM) ip += 2;
-                        else if (*ip == TOK_STR) {
-                            ip++;
-                            ip += *ip + 1;
-                            continue;
-                        }
-                        else if (*ip == TOK_VAR) ip++;
-                        ip++;
-                    }
-                    
-                    // Execute ELSE clause
-                    while (*ip != TOK_EOL) {
-                        int result = execute_statement(&ip, &pc);
-                        if (result == 0) {
-                            should_advance = 0;
-                            break;
-                        } else if (result == -1) {
-                            return;
-                        }
-                    }
-                }
-                break;
-            } else {
-                // Execute regular statement
-                int result = execute_statement(&ip, &pc);
-                if (result == 0) {
-                    should_advance = 0;
-                    break;
-                } else if (result == -1) {
-                    return;
-                }
-            }
-        }
-        
-        if (should_advance) {
-            pc += 3 + pc[2];
-        }
+static void snap_get_resume(struct basic_ctx *ctx, struct resume *r,
+                            uint16_t body_len) {
+    *r = (struct resume){ snap_get_pos(ctx, body_len) };
+    r->ip = snap_get_pos(ctx, body_len);
+    r->end = snap_get_pos(ctx, body_len);
+    snap_get(ctx, &r->in_if, 1, body_len);
+}
+
+// Restore the snapshot written by HIBERNATE, if there is a valid one, and
+// carry on where it was taken. Targets call this once at startup; it
+// returns 0 if there was nothing to resume.
+int basic_ctx_resume(struct basic_ctx *ctx) {
+    uint8_t h[SNAP_HEADER];
+    uint8_t compiled = 0, state;
+    uint16_t prog_len;
+    struct resume at;
+
+    stack_enter(ctx);
+    for (uint8_t i = 0; i < SNAP_HEADER; i++)
+        h[i] = fram_read(HIBERNATE_ADDR + i);
+    uint16_t len = h[2] | (h[3] << 8);
+    if ((h[0] | (h[1] << 8)) != SNAP_MAGIC || len > HIBERNATE_SIZE - SNAP_HEADER)
+        return 0;
+
+    // Verify the whole body before touching any state
+    snap_begin(ctx);
+    snap_get(ctx, NULL, len, len);
+    if (ctx->snap_sum != (h[4] | (h[5] << 8))) return 0;
+
+    // From here on, sizes are checked before they are used and anything
+    // this build cannot take goes to fail, which leaves a clean state
+    snap_begin(ctx);
+    snap_get(ctx, &compiled, 1, len);
+    prog_len = snap_get16(ctx, len);
+    if (prog_len > MAX_PROG) goto fail;
+    ctx->prog_len = prog_len;
+    snap_get(ctx, ctx->program, ctx->prog_len, len);
+    reset_gap(ctx);
+    index_program(ctx);
+#if MAX_CODE
+    if (compiled && !compile_program(ctx)) goto fail;
+#endif
+    if (compiled != (ctx->exec_base != ctx->program)) goto fail;
+
+    snap_get(ctx, ctx->vars, sizeof(ctx->vars), len);
+
+#if ARRAY_CELLS
+    uint16_t arena_top = snap_get16(ctx, len);
+    if (arena_top > ARRAY_CELLS) goto fail;
+    ctx->arena_top = arena_top;
+    snap_get(ctx, ctx->arrays, sizeof(ctx->arrays), len);
+    snap_get(ctx, ctx->arena, ctx->arena_top * sizeof(int16_t), len);
+    for (uint8_t v = 0; v < NUM_VARS; v++)
+        if (ctx->arrays[v].base + ctx->arrays[v].size > ctx->arena_top)
+            ctx->snap_fail = 1;
+#endif
+
+#if STRING_ARENA
+    str_reset(ctx);
+    uint16_t str_top = snap_get16(ctx, len);
+    if (str_top > STRING_ARENA) goto fail;
+    ctx->str_top = str_top;
+    snap_get(ctx, ctx->strs, NUM_VARS * sizeof(ctx->strs[0]), len);
+    snap_get(ctx, ctx->str_arena, ctx->str_top, len);
+    for (uint8_t v = 0; v < NUM_VARS; v++) {
+        if (ctx->strs[v].off + ctx->strs[v].len > ctx->str_top)
+            ctx->snap_fail = 1;
+        ctx->str_used += ctx->strs[v].len;
+    }
+#endif
+
+    tasks_reset(ctx);
+    uint8_t depth = 0;
+    snap_get(ctx, &depth, 1, len);
+    if (depth > FOR_DEPTH) goto fail;
+    ctx->for_sp = depth;
+    for (uint8_t i = 0; i < ctx->for_sp; i++) {
+        snap_get(ctx, &ctx->for_stack[i].var, 1, len);
+        ctx->for_stack[i].limit = snap_get16(ctx, len);
+        ctx->for_stack[i].step = snap_get16(ctx, len);
+        snap_get_resume(ctx, &ctx->for_stack[i].body, len);
+    }
+    depth = 0;
+    snap_get(ctx, &depth, 1, len);
+    if (depth > GOSUB_DEPTH) goto fail;
+    ctx->gosub_sp = depth;
+    for (uint8_t i = 0; i < ctx->gosub_sp; i++)
+        snap_get_resume(ctx, &ctx->gosub_stack[i], len);
+
+    state = SNAP_STOPPED;
+    snap_get(ctx, &state, 1, len);
+    if (state == SNAP_RUNNING) snap_get_resume(ctx, &at, len);
+    if (ctx->snap_fail) {
+fail:
+        // A checksummed snapshot this build cannot read: start afresh
+        ctx->prog_len = 0;
+        memset(ctx->vars, 0, sizeof(ctx->vars));
+        reset_gap(ctx);
+        index_program(ctx);
+        reset_arrays(ctx);
+        str_reset(ctx);
+        tasks_reset(ctx);
+        return 0;
     }
+
+    if (state == SNAP_RUNNING) run_from(ctx, &at);
+    out_flush(ctx);
+    return 1;
 }
 
-static void run(void) {
-    run_from(program);
+// HIBERNATE at the prompt keeps the program, variables and arrays;
+// HIBERNATE OFF removes the snapshot.
+static void hibernate_command(struct basic_ctx *ctx, uint8_t *arg) {
+    if (!strncmp((char*)arg, " OFF", 4)) {
+        snap_header(0, 0, 0);
+        return;
+    }
+
+    close_gap(ctx);
+    uint16_t len = snapshot(ctx, NULL);
+    if (ctx->fault) {
+        out_str(ctx, ctx->fault);
+        ctx->fault = NULL;
+    } else {
+        out_str(ctx, "Hibernated ");
+        out_uint(ctx, len);
+        out_str(ctx, " bytes");
+    }
+    out_str(ctx, "\r\n");
 }
 
+#endif
+
 /* ================= LIST ================= */
 
-void print(uint8_t len, uint8_t *str) {
+void print(struct basic_ctx *ctx, uint8_t len, uint8_t *str) {
+    out_bytes(ctx, str, len);
+}
 
-	for (uint8_t i = 0; i < len; i++ ) {
-		putchar(str[i]);
-	}
+// Negative literals only come from folding; the parentheses make them
+// read back as the same value
+static void print_num(struct basic_ctx *ctx, int16_t v) {
+    if (v < 0) {
+        out_char(ctx, '(');
+        out_int(ctx, v);
+        out_char(ctx, ')');
+    } else {
+        out_int(ctx, v);
+    }
+}
 
+static void print_keyword(struct basic_ctx *ctx, uint8_t tok) {
+    for (const struct keyword *k = keywords; k < keywords + NUM_KEYWORDS; k++) {
+        if (k->tok == tok) {
+            if (k->flags & KW_SPACE_BEFORE) out_char(ctx, ' ');
+            out_str(ctx, k->name);
+            if (k->flags & KW_SPACE_AFTER) out_char(ctx, ' ');
+            return;
+        }
+    }
 }
 
-static void print_token(uint8_t **ip) {
-    switch (*(*ip)++) {
-        case TOK_LET:   printf("LET "); break;
-        case TOK_PRINT: printf("PRINT "); break;
-        case TOK_INPUT: printf("INPUT "); break;
-        case TOK_GOTO:  printf("GOTO "); break;
-        case TOK_END:   printf("END"); break;
-        case TOK_IF:    printf("IF "); break;
-        case TOK_THEN:  printf("THEN "); break;
-        case TOK_ELSE:  printf("ELSE "); break;
-        case TOK_PEEK:  printf("PEEK"); break;
-        case TOK_POKE:  printf("POKE "); break;
-        case TOK_SLEEP: printf("SLEEP "); break;
+static void print_token(struct basic_ctx *ctx, uint8_t **ip) {
+    uint8_t tok = *(*ip)++;
+
+    if (IS_VAR(tok)) {
+        out_char(ctx, 'A' + tok - TOK_VAR);
+        return;
+    }
 
-        case TOK_VAR:
-            printf("%c", 'A' + *(*ip)++);
-            break;
+    switch (tok) {
+        case TOK_SVAR:
+            out_char(ctx, 'A' + *(*ip)++);
+            out_char(ctx, '$');
+            return;
+
+        case TOK_BYTE:
+            out_uint(ctx, *(*ip)++);
+            return;
 
-        case TOK_NUM: {
-            int16_t v = (*ip)[0] | ((*ip)[1] << 8);
+        case TOK_NUM:
+            print_num(ctx, (*ip)[0] | ((*ip)[1] << 8));
             *ip += 2;
-            printf("%d", v);
-            break;
-        }
+            return;
+
+        case TOK_DIVC:
+            print_keyword(ctx, TOK_DIV);
+            print_num(ctx, divc_divisor((*ip)[0] | ((*ip)[1] << 8), (*ip)[2]));
+            *ip += 3;
+            return;
 
         case TOK_STR: {
             uint8_t len = *(*ip)++;
-            putchar('\"');
-            print(len, (uint8_t*)*ip);
-            putchar('\"');
+            out_char(ctx, '\"');
+            print(ctx, len, (uint8_t*)*ip);
+            out_char(ctx, '\"');
             *ip += len;
-            break;
+            return;
         }
+    }
 
-        case TOK_PLUS:  printf(" + "); break;
-        case TOK_MINUS: printf(" - "); break;
-        case TOK_MUL:   printf(" * "); break;
-        case TOK_DIV:   printf(" / "); break;
-        case TOK_EQ:    printf(" = "); break;
-        case TOK_LT:    printf(" < "); break;
-        case TOK_GT:    printf(" > "); break;
-        case TOK_LE:    printf(" <= "); break;
-        case TOK_GE:    printf(" >= "); break;
-        case TOK_NE:    printf(" <> "); break;
-        case TOK_EQEQ:  printf(" == "); break;
-        case TOK_LPAREN: printf("("); break;
-        case TOK_RPAREN: printf(")"); break;
-        case TOK_COMMA:  printf(", "); break;
-
-        case TOK_EOL:
-            break;
+    print_keyword(ctx, tok);
+}
+
+static void list_line(struct basic_ctx *ctx, uint8_t *p) {
+    uint8_t *ip = p + LINE_HEADER;
+
+    out_uint(ctx, LINE_NUM(p));
+    out_char(ctx, ' ');
+    while (*ip != TOK_EOL)
+        print_token(ctx, &ip);
+    out_str(ctx, "\r\n");
+}
+
+static void list_program(struct basic_ctx *ctx) {
+    uint8_t *p = ctx->program;
+
+    close_gap(ctx);
+
+    while (p < ctx->program + ctx->prog_len) {
+        list_line(ctx, p);
+        p += LINE_SIZE(p);
     }
 }
 
-static void list_program(void) {
-    uint8_t *p = program;
+#ifdef BASIC_PROFILE
+// Lines run by the last RUN, slowest first, next to their listing
+static void profile_report(struct basic_ctx *ctx) {
+    uint16_t order[MAX_LINES];
+    uint16_t n = 0;
+
+    for (uint16_t i = 0; i < ctx->line_count; i++) {
+        if (!ctx->prof[i].count) continue;
+        uint16_t j = n++;
+        while (j > 0 && ctx->prof[order[j - 1]].ticks < ctx->prof[i].ticks) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
 
-    while (p < program + prog_len) {
-        uint16_t ln = p[0] | (p[1] << 8);
-        uint8_t len = p[2];
-        uint8_t *ip = p + 3;
+    out_str(ctx, "     COUNT   TIME (us)     GOTOS  LINE\r\n");
+    for (uint16_t i = 0; i < n; i++) {
+        out_column(ctx, ctx->prof[order[i]].count, 10);
+        out_column(ctx, ctx->prof[order[i]].ticks, 12);
+        out_column(ctx, ctx->prof[order[i]].gotos, 10);
+        out_str(ctx, "  ");
+        list_line(ctx, ctx->program + ctx->line_index[order[i]]);
+    }
+}
+#endif
 
-        printf("%u ", ln);
-        while (*ip != TOK_EOL)
-            print_token(&ip);
-        printf("\r\n");
+static void stats_report(struct basic_ctx *ctx) {
+    static const char names[NUM_STATS][11] = {
+        "STATEMENTS", "LINES RUN", "ENTERED", "FIND LINE", "SCANNED",
+        "MAX DEPTH", "PEEKS", "POKES", "PRINTED", "SAVE US", "LOAD US",
+        "STR PEAK", "STR GC", "STACK MAX", "CACHE HITS", "CACHE MISS"
+    };
 
-        p += 3 + len;
+    for (uint8_t i = 0; i < NUM_STATS; i++) {
+        out_str(ctx, names[i]);
+        for (uint8_t n = strlen(names[i]); n < 11; n++) out_char(ctx, ' ');
+        out_column(ctx, ctx->stats[i], 10);
+        out_str(ctx, "\r\n");
     }
 }
 
 /* ================= COMMAND PROCESSING ================= */
 
-static void process_command(uint8_t *line) {
+// Store or delete a numbered line typed at the prompt. Its token buffer
+// stays off the stack of RUN and the other commands.
+static NOINLINE void enter_line(struct basic_ctx *ctx, uint8_t *line) {
+    uint16_t ln = atoi((char*)line);
+    char *src = strchr((char*)line, ' ');
+    uint8_t buf[MAX_LINE * 2 + 1];  // a one-digit number takes two bytes
+    int len = src ? tokenize(src + 1, buf) : 0;
+
+    store_line(ctx, ln, buf, len);
+}
+
+static void process_command(struct basic_ctx *ctx, uint8_t *line) {
     if (!strncmp((char*)line, "RUN", 3)) {
-        run();
+#if LINE_CACHE
+        char *filename = strchr((char*)line, ' ');
+        if (filename && filename[1] > ' ') {
+            // Trim whitespace and newline
+            char *end = ++filename;
+            while (*end && *end != '\r' && *end != '\n' && *end != ' ') end++;
+            *end = '\0';
+            run_file(ctx, filename);
+            return;
+        }
+#endif
+        run(ctx);
         return;
     }
     if (!strncmp((char*)line, "LIST", 4)) {
-        list_program();
+        list_program(ctx);
+        return;
+    }
+    if (!strncmp((char*)line, "STATS", 5)) {
+        if (!strncmp((char*)line + 5, " RESET", 6))
+            memset(ctx->stats, 0, sizeof(ctx->stats));
+        else
+            stats_report(ctx);
+        return;
+    }
+#ifdef HIBERNATE_ADDR
+    if (!strncmp((char*)line, "HIBERNATE", 9)) {
+        hibernate_command(ctx, line + 9);
+        return;
+    }
+#endif
+#ifdef BASIC_PROFILE
+    if (!strncmp((char*)line, "PROFILE", 7)) {
+        profile_report(ctx);
         return;
     }
+#endif
     if (!strncmp((char*)line, "SAVE", 4)) {
         char *filename = strchr((char*)line, ' ');
         if (filename) {
@@ -639,13 +3628,25 @@ static void process_command(uint8_t *line) {
             while (*end && *end != '\r' && *end != '\n' && *end != ' ') end++;
             *end = '\0';
             
-            if (hw_save(filename, program, prog_len) == 0) {
-                printf("Saved %d bytes to %s\r\n", prog_len, filename);
+            close_gap(ctx);
+            out_flush(ctx);
+            ctx->program[ctx->prog_len] = IMAGE_TAG;
+            ctx->program[ctx->prog_len + 1] = IMAGE_VERSION;
+            uint32_t start = hw_ticks();
+            int err = hw_save(filename, ctx->program,
+                              ctx->prog_len + IMAGE_TRAILER);
+            ctx->stats[STAT_SAVE_US] = hw_ticks() - start;
+            if (err == 0) {
+                out_str(ctx, "Saved ");
+                out_uint(ctx, ctx->prog_len);
+                out_str(ctx, " bytes to ");
             } else {
-                printf("Error saving to %s\r\n", filename);
+                out_str(ctx, "Error saving to ");
             }
+            out_str(ctx, filename);
+            out_str(ctx, "\r\n");
         } else {
-            printf("Usage: SAVE <filename>\r\n");
+            out_str(ctx, "Usage: SAVE <filename>\r\n");
         }
         return;
     }
@@ -658,50 +3659,163 @@ static void process_command(uint8_t *line) {
             while (*end && *end != '\r' && *end != '\n' && *end != ' ') end++;
             *end = '\0';
             
-            if (hw_load(filename, program, &prog_len, MAX_PROG) == 0) {
-                printf("Loaded %d bytes from %s\r\n", prog_len, filename);
+            close_gap(ctx);
+            out_flush(ctx);
+            uint16_t len;
+            uint32_t start = hw_ticks();
+            int err = hw_load(filename, ctx->program, &len,
+                              MAX_PROG + IMAGE_TRAILER);
+            ctx->stats[STAT_LOAD_US] = hw_ticks() - start;
+            if (err == 0 && !load_image(ctx, len)) err = -1;
+            // A failed read may have overwritten part of the store
+            if (err) ctx->prog_len = 0;
+            reset_gap(ctx);
+            index_program(ctx);
+            if (err == 0) {
+                out_str(ctx, "Loaded ");
+                out_uint(ctx, ctx->prog_len);
+                out_str(ctx, " bytes from ");
             } else {
-                printf("Error loading from %s\r\n", filename);
+                out_str(ctx, "Error loading from ");
             }
+            out_str(ctx, filename);
+            out_str(ctx, "\r\n");
         } else {
-            printf("Usage: LOAD <filename>\r\n");
+            out_str(ctx, "Usage: LOAD <filename>\r\n");
         }
         return;
     }
 
-    uint16_t ln = atoi((char*)line);
-    if (find_line(ln) != NULL) delete_line(ln);
-    char *src = strchr((char*)line, ' ');
-    if (!src) return;
-
-    uint8_t buf[64];
-    int len = tokenize(src + 1, buf);
-
-    insert_line(ln, buf, len);
+    enter_line(ctx, line);
 }
 
 /* ================= INPUT ROUTING ================= */
 
-void basic_yield(uint8_t *line) {
+void basic_ctx_init(struct basic_ctx *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    reset_gap(ctx);
+    index_program(ctx);
+    tasks_reset(ctx);
+    PROF_RESET();
+}
+
+void basic_ctx_yield(struct basic_ctx *ctx, uint8_t *line) {
+    stack_enter(ctx);
     // printf(" B %s\r\n", line);
-    if (current_input_mode == INPUT_MODE_AWAITING_INPUT) {
+    if (ctx->current_input_mode == INPUT_MODE_AWAITING_INPUT) {
         // Deliver line to INPUT statement handler directly
-        handle_input_response(line);
-        
-        // Reset to command mode
-        current_input_mode = INPUT_MODE_COMMAND;
+        handle_input_response(ctx, line);
+    } else if (ctx->current_input_mode == INPUT_MODE_SLEEPING ||
+               ctx->current_input_mode == INPUT_MODE_RUNNING) {
+        // The program still owns program[] and the variables
+        out_str(ctx, "Running, Ctrl-C to stop\r\n");
     } else {
         // Normal command processing
-        process_command(line);
+        process_command(ctx, line);
+    }
+    out_flush(ctx);
+}
+
+// Run the tasks whose SLEEP is over, if the program is sleeping
+static void poll_tasks(struct basic_ctx *ctx) {
+    if (ctx->current_input_mode != INPUT_MODE_SLEEPING) return;
+
+    tasks_wake(ctx);
+    uint8_t n = task_next(ctx);
+    if (n == NO_TASK) return;
+
+    ctx->current_input_mode = INPUT_MODE_COMMAND;
+    task_load(ctx, n);
+    run_from(ctx, &ctx->tasks[n].at);
+    out_flush(ctx);
+}
+
+void basic_ctx_poll(struct basic_ctx *ctx) {
+    stack_enter(ctx);
+    poll_tasks(ctx);
+}
+
+void basic_ctx_break(struct basic_ctx *ctx) {
+    if (ctx->current_input_mode == INPUT_MODE_SLEEPING ||
+        ctx->current_input_mode == INPUT_MODE_RUNNING) {
+        struct resume *at = ctx->current_input_mode == INPUT_MODE_SLEEPING ?
+                            &ctx->tasks[ctx->cur_task].at : &ctx->step_at;
+        RESUME(at);
+        out_str(ctx, "Break in line ");
+        out_uint(ctx, LINE_NUM(at->pc));
+        out_str(ctx, "\r\n");
+    } else if (ctx->current_input_mode == INPUT_MODE_AWAITING_INPUT) {
+        out_str(ctx, "Break\r\n");
+    }
+    ctx->current_input_mode = INPUT_MODE_COMMAND;
+    ctx->execution_pc = NULL;
+    out_flush(ctx);
+}
+
+int basic_ctx_step(struct basic_ctx *ctx, uint32_t max_statements,
+                   uint32_t max_us) {
+    stack_enter(ctx);
+    ctx->slice_max = max_statements;
+    ctx->slice_us = max_us;
+
+    if (ctx->current_input_mode == INPUT_MODE_RUNNING) {
+        ctx->current_input_mode = INPUT_MODE_COMMAND;
+        run_from(ctx, &ctx->step_at);
+        out_flush(ctx);
+    } else {
+        poll_tasks(ctx);
     }
+
+    switch (ctx->current_input_mode) {
+        case INPUT_MODE_RUNNING:        return BASIC_RUNNING;
+        case INPUT_MODE_AWAITING_INPUT: return BASIC_INPUT;
+        case INPUT_MODE_SLEEPING:       return BASIC_SLEEPING;
+        default:                        return BASIC_ENDED;
+    }
+}
+
+// The interpreter behind the basic_* entry points, set up on first use
+static struct basic_ctx basic_default;
+
+static struct basic_ctx *default_ctx(void) {
+    if (!basic_default.exec_base) basic_ctx_init(&basic_default);
+    return &basic_default;
+}
+
+void basic_yield(uint8_t *line) {
+    basic_ctx_yield(default_ctx(), line);
+}
+
+void basic_poll(void) {
+    basic_ctx_poll(default_ctx());
+}
+
+void basic_break(void) {
+    basic_ctx_break(default_ctx());
+}
+
+int basic_step(uint32_t max_statements, uint32_t max_us) {
+    return basic_ctx_step(default_ctx(), max_statements, max_us);
+}
+
+#ifdef HIBERNATE_ADDR
+int basic_resume(void) {
+    return basic_ctx_resume(default_ctx());
 }
+#endif
 
 /* ================= MAIN (Linux only) ================= */
 
 #ifdef TARGET_LINUX
 
-void hw_sleep(uint16_t secs) {
-   sleep(secs);
+void hw_write(const uint8_t *data, uint16_t len) {
+    fwrite(data, 1, len, stdout);
+}
+
+uint32_t hw_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
 }
 
 uint8_t hw_peek(uint8_t addr) {
@@ -770,21 +3884,427 @@ int hw_load(const char *filename, uint8_t *data, uint16_t *len, uint16_t max_len
     return 0;
 }
 
-int main(void) {
+// Statements per basic_step() slice (-b)
+static uint32_t step_budget = 1000;
+
+// Milliseconds until the first sleeping task is due, rounded up
+static int sleep_ms_left(struct basic_ctx *ctx) {
+    int64_t first = INT64_MAX;
+
+    for (uint8_t n = 0; n < MAX_TASKS; n++) {
+        struct task *t = &ctx->tasks[n];
+        if (t->state != TASK_SLEEPING) continue;
+        int64_t us = (int64_t)t->sleep_secs * 1000000 -
+                     (hw_ticks() - t->sleep_mark);
+        if (us < first) first = us;
+    }
+    return first > 0 ? (first + 999) / 1000 : 0;
+}
+
+// Run one batch line, feeding any INPUT it waits for from the input stream
+// (if any) and waiting out any SLEEP
+static void batch_command(struct basic_ctx *ctx, char *line, FILE *input) {
+    char value[MAX_LINE];
+
+    basic_ctx_yield(ctx, (uint8_t*)line);
+    for (;;) {
+        int status = basic_ctx_step(ctx, step_budget, 0);
+        if (status == BASIC_SLEEPING)
+            usleep(sleep_ms_left(ctx) * 1000);
+        else if (status == BASIC_INPUT && input &&
+                 fgets(value, sizeof(value), input))
+            basic_ctx_yield(ctx, (uint8_t*)value);
+        else if (status != BASIC_RUNNING)
+            break;
+    }
+}
+
+// A whole source file as a string, or NULL with errno set if it cannot
+// be read
+static char *read_source(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+
+    size_t size = 0, cap = 4096, n;
+    char *text = malloc(cap + 1);
+    while (text && (n = fread(text + size, 1, cap - size, f)) > 0) {
+        size += n;
+        if (size == cap) {
+            char *more = realloc(text, (cap *= 2) + 1);
+            if (!more) free(text);
+            text = more;
+        }
+    }
+    fclose(f);
+    if (text) text[size] = 0;
+    return text;
+}
+
+// Enter a source file line by line, then RUN it unless it did so itself
+static void run_source(struct basic_ctx *ctx, char *text, FILE *input) {
+    int ran = 0;
+    char *line = text;
+
+    ctx->batch_mode = 1;
+    while (*line) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = 0;
+        else next = line + strlen(line);
+        line[strcspn(line, "\r")] = 0;
+
+        // Same limit as an interactive line
+        if (strlen(line) >= MAX_LINE) line[MAX_LINE - 1] = 0;
+
+        if (*line) {
+            if (!strncmp(line, "RUN", 3)) ran = 1;
+            batch_command(ctx, line, input);
+        }
+        line = next;
+    }
+
+    // A file holding just the program runs it
+    if (!ran) {
+        char cmd[] = "RUN";
+        batch_command(ctx, cmd, input);
+    }
+}
+
+// Batch mode: run a whole source file without prompts. INPUT values are
+// read from a separate stream and output is fully buffered.
+static int run_batch(const char *filename, FILE *input, int report) {
+    struct basic_ctx *ctx = default_ctx();
+    char *text = read_source(filename);
+    if (!text) {
+        fprintf(stderr, "Cannot read %s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    run_source(ctx, text, input);
+
+    free(text);
+    fflush(stdout);
+    if (report)
+        fprintf(stderr, "statements %u lines %u\n",
+                (unsigned)ctx->stats[STAT_STATEMENTS],
+                (unsigned)ctx->stats[STAT_LINES_RUN]);
+    return 0;
+}
+
+/* Job runner (-j): many batch programs at once */
+
+// Every job runs in its own interpreter on one of a pool of threads, with
+// its output collected in memory and printed in command line order once
+// all are done. INPUT gets no values. Each worker starts with an equal
+// run of jobs and, when it has none left, steals the later half of
+// another's, so a few slow programs do not hold up the rest.
+struct job {
+    const char *filename;
+    char *out;
+    size_t len, cap;
+    int failed;                 // errno if it could not be read
+    uint32_t statements, lines;
+};
+
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    size_t next, end;           // jobs not yet started
+};
+
+static struct job *jobs;
+static struct worker *workers;
+static int num_workers;
+
+static void job_write(void *user, const uint8_t *data, uint16_t len) {
+    struct job *job = user;
+
+    if (job->len + len > job->cap) {
+        size_t cap = (job->len + len) * 2;
+        char *out = realloc(job->out, cap);
+        if (!out) return;
+        job->out = out;
+        job->cap = cap;
+    }
+    memcpy(job->out + job->len, data, len);
+    job->len += len;
+}
+
+// The trace hw_poke() prints, kept with the job's output
+static void job_poke(void *user, uint8_t addr, uint8_t val) {
+    char trace[32];
+    int n = snprintf(trace, sizeof(trace), " POKE 0x%x <- 0x%x\r\n", addr, val);
+    job_write(user, (const uint8_t*)trace, n);
+}
+
+static int take_job(struct worker *self, size_t *j) {
+    pthread_mutex_lock(&self->lock);
+    int found = self->next < self->end;
+    if (found) *j = self->next++;
+    pthread_mutex_unlock(&self->lock);
+    if (found) return 1;
+
+    for (int i = 1; i < num_workers; i++) {
+        struct worker *victim = &workers[(self - workers + i) % num_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        size_t end = victim->end;
+        size_t from = end - (end - victim->next + 1) / 2;
+        victim->end = from;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (from < end) {
+            pthread_mutex_lock(&self->lock);
+            self->next = from + 1;
+            self->end = end;
+            pthread_mutex_unlock(&self->lock);
+            *j = from;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *self = arg;
+    struct basic_ctx *ctx = malloc(sizeof(*ctx));
+    size_t j;
+
+    // Without an interpreter, leave this worker's jobs to the others
+    if (!ctx) return NULL;
+
+    while (take_job(self, &j)) {
+        struct job *job = &jobs[j];
+        char *text = read_source(job->filename);
+        if (!text) {
+            job->failed = errno ? errno : EIO;
+            continue;
+        }
+        basic_ctx_init(ctx);
+        ctx->write = job_write;
+        ctx->poke = job_poke;
+        ctx->user = job;
+        run_source(ctx, text, NULL);
+        job->statements = ctx->stats[STAT_STATEMENTS];
+        job->lines = ctx->stats[STAT_LINES_RUN];
+        free(text);
+    }
+    free(ctx);
+    return NULL;
+}
+
+// Run count files on threads workers (0 for one per core)
+static int run_jobs(char **files, int count, int threads, int report) {
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > count) threads = count;
+    if (threads < 1) threads = 1;
+
+    jobs = calloc(count, sizeof(*jobs));
+    workers = calloc(threads, sizeof(*workers));
+    if (!jobs || !workers) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) jobs[i].filename = files[i];
+
+    num_workers = threads;
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        workers[i].next = (size_t)count * i / threads;
+        workers[i].end = (size_t)count * (i + 1) / threads;
+    }
+    for (int i = 1; i < threads; i++)
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    worker_main(&workers[0]);
+    for (int i = 1; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    int failed = 0;
+    uint64_t statements = 0, lines = 0;
+    for (int i = 0; i < count; i++) {
+        struct job *job = &jobs[i];
+        if (job->failed) {
+            fprintf(stderr, "Cannot read %s: %s\n", job->filename,
+                    strerror(job->failed));
+            failed = 1;
+            continue;
+        }
+        if (count > 1) printf("==> %s <==\n", job->filename);
+        fwrite(job->out, 1, job->len, stdout);
+        statements += job->statements;
+        lines += job->lines;
+        free(job->out);
+    }
+    fflush(stdout);
+    if (report)
+        fprintf(stderr, "jobs %d threads %d statements %llu lines %llu\n",
+                count, threads, (unsigned long long)statements,
+                (unsigned long long)lines);
+
+    for (int i = 0; i < threads; i++) pthread_mutex_destroy(&workers[i].lock);
+    free(workers);
+    free(jobs);
+    return failed;
+}
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int sig) {
+    interrupted = 1;
+}
+
+// Interactive input is read into in_buf as it arrives, but lines are only
+// taken from it while no program runs or sleeps; until then they wait
+// there, or in the pipe once in_buf is full. A 0x03 byte (Ctrl-C sent as
+// a byte) among them breaks a sleeping program as SIGINT does, and its
+// line is dropped.
+static char in_buf[4096];
+static size_t in_len;
+
+// Read what stdin has within ms milliseconds (-1 to wait for it); returns
+// 0 at the end of input
+static int read_input(int ms) {
+    if (in_len == sizeof(in_buf)) {
+        if (ms > 0) usleep(ms * 1000);
+        return 1;
+    }
+
+    struct pollfd pfd = { 0, POLLIN, 0 };
+    if (poll(&pfd, 1, ms) <= 0) return 1;
+
+    ssize_t n = read(0, in_buf + in_len, sizeof(in_buf) - in_len);
+    if (n <= 0) return 0;
+    in_len += n;
+    return 1;
+}
+
+// Drop the first line of in_buf holding a 0x03 byte; returns 0 if none does
+static int take_break(void) {
+    char *p = memchr(in_buf, 0x03, in_len);
+    if (!p) return 0;
+
+    char *start = p, *end = in_buf + in_len;
+    while (start > in_buf && start[-1] != '\n') start--;
+    char *next = memchr(p, '\n', end - p);
+    next = next ? next + 1 : end;
+    memmove(start, next, end - next);
+    in_len -= next - start;
+    return 1;
+}
+
+// Take the next line from in_buf, as fgets() would into MAX_LINE bytes;
+// at the end of input an unterminated last line is taken too
+static int take_line(char *line, int eof) {
+    char *nl = memchr(in_buf, '\n', in_len);
+    size_t n = nl ? (size_t)(nl + 1 - in_buf) : in_len;
+
+    if (n > MAX_LINE - 1) n = MAX_LINE - 1;
+    else if (!nl && !eof) return 0;
+    if (!n) return 0;
+
+    memcpy(line, in_buf, n);
+    line[n] = 0;
+    in_len -= n;
+    memmove(in_buf, in_buf + n, in_len);
+    return 1;
+}
+
+int main(int argc, char **argv) {
     char line[MAX_LINE];
+    const char *batch_file = NULL;
+    FILE *input = stdin;
+    int report = 0;
+    int threads = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:f:i:j:s")) != -1) {
+        switch (opt) {
+            case 'f':
+                batch_file = optarg;
+                break;
+            case 'i':
+                input = fopen(optarg, "r");
+                if (!input) {
+                    fprintf(stderr, "Cannot open %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                report = 1;
+                break;
+            case 'b':
+                step_budget = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] [-b statements] "
+                        "[-f program.bas [-i input] | -j threads "
+                        "program.bas...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (threads >= 0) return run_jobs(argv + optind, argc - optind, threads,
+                                      report);
+    if (!batch_file && optind < argc) batch_file = argv[optind];
+
+    // Nothing is running yet; this only sets the slice size for RUN
+    basic_step(step_budget, 0);
+
+    if (batch_file) return run_batch(batch_file, input, report);
 
     puts("///");
 
+    // An example driver loop: the program runs in slices of step_budget
+    // statements, between which a break is checked, and a sleeping program
+    // is woken on time while input is read ahead. Lines typed while a
+    // program runs or sleeps wait until it stops or asks for INPUT.
+    signal(SIGINT, on_interrupt);
+
+    struct basic_ctx *ctx = default_ctx();
+    int prompt = 1;
+    int eof = 0;
+
     while (1) {
-        if (current_input_mode == INPUT_MODE_COMMAND) {
+        int busy = ctx->current_input_mode == INPUT_MODE_SLEEPING ||
+                   ctx->current_input_mode == INPUT_MODE_RUNNING;
+        if (interrupted) {
+            interrupted = 0;
+            basic_break();
+            prompt = 1;
+        }
+        int status = basic_step(step_budget, 0);
+        if (busy && status == BASIC_ENDED) prompt = 1;
+        if (status == BASIC_RUNNING) continue;
+
+        if (status == BASIC_SLEEPING) {
+            int timeout = sleep_ms_left(ctx);
+            fflush(stdout);
+            if (take_break()) interrupted = 1;
+            else if (eof) usleep(timeout * 1000);
+            else if (!read_input(timeout)) eof = 1;
+            continue;
+        }
+
+        if (status == BASIC_ENDED && prompt) {
             printf("> ");
+            prompt = 0;
         }
-        fflush(stdout);
-        
-        if (!fgets(line, sizeof(line), stdin))
-            break;
 
-        basic_yield((uint8_t*)line);
+        if (take_line(line, eof)) {
+            if (strchr(line, 0x03))
+                basic_break();      // Ctrl-C sent as a byte
+            else
+                basic_yield((uint8_t*)line);
+            prompt = 1;
+            continue;
+        }
+        if (eof) break;
+
+        fflush(stdout);
+        if (!read_input(-1)) eof = 1;
     }
     
     return 0;
@@ -0,0 +1,10 @@
+10 LET J = 0
+20 LET I = 0
+30 LET S = S + I * 3 - I / 2
+40 IF S > 10000 THEN LET S = S - 10000
+50 LET I = I + 1
+60 IF I < 30000 THEN GOTO 30
+70 LET J = J + 1
+80 IF J < 20 THEN GOTO 20
+90 PRINT S
+100 END
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Compare dispatch engines: run each binary on the workload and print
+# the best wall time of several runs.
+#
+# Usage: bench/dispatch.sh ./basic ./basic-threaded [workload.bas] [runs]
+
+WORKLOAD=${3:-$(dirname "$0")/count.bas}
+RUNS=${4:-5}
+
+best_time() {
+    local best=""
+    for i in $(seq 1 $RUNS); do
+        local start=$(date +%s%N)
+        "$1" -f "$WORKLOAD" > /dev/null
+        local ms=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$best" ] || [ $ms -lt $best ]; then best=$ms; fi
+    done
+    echo $best
+}
+
+for bin in "$1" "$2"; do
+    printf "%-20s %6d ms\n" "$bin" "$(best_time "$bin")"
+done
+
+if ! cmp -s <("$1" -f "$WORKLOAD") <("$2" -f "$WORKLOAD"); then
+    echo "Output differs between engines"
+    exit 1
+fi
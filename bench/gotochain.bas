@@ -0,0 +1,92 @@
+10 LET N = 0
+20 LET B = 9000
+30 GOTO 9000
+100 LET A = 0
+110 LET A = 1
+120 LET A = 2
+130 LET A = 3
+140 LET A = 4
+150 LET A = 5
+160 LET A = 6
+170 LET A = 7
+180 LET A = 8
+190 LET A = 9
+200 LET A = 10
+210 LET A = 11
+220 LET A = 12
+230 LET A = 13
+240 LET A = 14
+250 LET A = 15
+260 LET A = 16
+270 LET A = 17
+280 LET A = 18
+290 LET A = 19
+300 LET A = 20
+310 LET A = 21
+320 LET A = 22
+330 LET A = 23
+340 LET A = 24
+350 LET A = 25
+360 LET A = 26
+370 LET A = 27
+380 LET A = 28
+390 LET A = 29
+400 LET A = 30
+410 LET A = 31
+420 LET A = 32
+430 LET A = 33
+440 LET A = 34
+450 LET A = 35
+460 LET A = 36
+470 LET A = 37
+480 LET A = 38
+490 LET A = 39
+500 LET A = 40
+510 LET A = 41
+520 LET A = 42
+530 LET A = 43
+540 LET A = 44
+550 LET A = 45
+560 LET A = 46
+570 LET A = 47
+580 LET A = 48
+590 LET A = 49
+600 LET A = 50
+610 LET A = 51
+620 LET A = 52
+630 LET A = 53
+640 LET A = 54
+650 LET A = 55
+660 LET A = 56
+670 LET A = 57
+680 LET A = 58
+690 LET A = 59
+700 LET A = 60
+710 LET A = 61
+720 LET A = 62
+730 LET A = 63
+740 LET A = 64
+750 LET A = 65
+760 LET A = 66
+770 LET A = 67
+780 LET A = 68
+790 LET A = 69
+9000 LET N = N + 1
+9010 GOTO 9020
+9020 GOTO B + 30
+9030 GOTO 9040
+9040 GOTO B + 50
+9050 GOTO 9060
+9060 GOTO B + 70
+9070 GOTO 9080
+9080 GOTO B + 90
+9090 GOTO 9100
+9100 GOTO B + 110
+9110 GOTO 9120
+9120 GOTO B + 130
+9130 GOTO 9140
+9140 GOTO B + 150
+9150 GOTO 9160
+9160 GOTO B + 170
+9170 IF N < 20000 THEN GOTO 9000
+9180 PRINT N
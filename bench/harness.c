@@ -0,0 +1,206 @@
+/*
+ * Machdyne BASIC benchmark harness (Linux)
+ *
+ * Runs each workload through the interpreter's batch mode N times and
+ * prints the results as JSON: statements/sec and ns per line (from the
+ * counts the interpreter reports with -s), wall time, peak RSS and, where
+ * perf_event_open is permitted, hardware counters.
+ *
+ * Usage: harness [-n runs] ./basic workload.bas...
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define MAX_RUNS 100
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counters[] = {
+    { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "cache_misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+#define NUM_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+struct run {
+    uint64_t wall_ns;
+    long max_rss_kb;
+    unsigned long statements, lines;
+    uint64_t counts[NUM_COUNTERS];
+    int have_counts;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Open a counter on pid, started when it calls exec
+static int open_counter(pid_t pid, int i) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counters[i].type;
+    attr.config = counters[i].config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static int run_once(const char *basic, const char *workload, struct run *r) {
+    int go[2], report[2];
+    int fds[NUM_COUNTERS];
+
+    if (pipe(go) || pipe(report)) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+
+    if (pid == 0) {
+        // wait until the parent has attached the counters
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 1) _exit(127);
+
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(report[1], STDERR_FILENO);
+        execl(basic, basic, "-s", "-f", workload, (char *)NULL);
+        _exit(127);
+    }
+
+    close(go[0]);
+    close(report[1]);
+
+    r->have_counts = 1;
+    for (size_t i = 0; i < NUM_COUNTERS; i++) {
+        fds[i] = open_counter(pid, i);
+        if (fds[i] < 0) r->have_counts = 0;
+    }
+
+    uint64_t start = now_ns();
+    if (write(go[1], "x", 1) != 1) return -1;
+    close(go[1]);
+
+    char buf[128];
+    ssize_t n = read(report[0], buf, sizeof(buf) - 1);
+    buf[n > 0 ? n : 0] = 0;
+    close(report[0]);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    r->wall_ns = now_ns() - start;
+    r->max_rss_kb = ru.ru_maxrss;
+
+    for (size_t i = 0; i < NUM_COUNTERS; i++) {
+        if (fds[i] < 0) continue;
+        if (read(fds[i], &r->counts[i], sizeof(uint64_t)) != sizeof(uint64_t))
+            r->have_counts = 0;
+        close(fds[i]);
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    if (sscanf(buf, "statements %lu lines %lu", &r->statements, &r->lines) != 2)
+        return -1;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static const char *basename_of(const char *path) {
+    const char *s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+int main(int argc, char **argv) {
+    int runs = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') runs = atoi(optarg);
+        else {
+            fprintf(stderr, "Usage: %s [-n runs] ./basic workload.bas...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1 || runs > MAX_RUNS || argc - optind < 2) {
+        fprintf(stderr, "Usage: %s [-n runs] ./basic workload.bas...\n", argv[0]);
+        return 1;
+    }
+
+    const char *basic = argv[optind++];
+    printf("{\n  \"interpreter\": \"%s\",\n  \"runs\": %d,\n  \"workloads\": [",
+           basic, runs);
+
+    for (int w = optind; w < argc; w++) {
+        struct run r[MAX_RUNS];
+        uint64_t wall[MAX_RUNS];
+        long rss = 0;
+
+        for (int i = 0; i < runs; i++) {
+            if (run_once(basic, argv[w], &r[i])) {
+                fprintf(stderr, "%s: run failed\n", argv[w]);
+                return 1;
+            }
+            wall[i] = r[i].wall_ns;
+            if (r[i].max_rss_kb > rss) rss = r[i].max_rss_kb;
+        }
+
+        // counters come from the fastest run
+        int best = 0;
+        for (int i = 1; i < runs; i++)
+            if (r[i].wall_ns < r[best].wall_ns) best = i;
+        qsort(wall, runs, sizeof(uint64_t), cmp_u64);
+
+        printf("%s\n    {\n", w > optind ? "," : "");
+        printf("      \"name\": \"%s\",\n", basename_of(argv[w]));
+        printf("      \"statements\": %lu,\n", r[best].statements);
+        printf("      \"lines\": %lu,\n", r[best].lines);
+        printf("      \"wall_ns_min\": %llu,\n", (unsigned long long)wall[0]);
+        printf("      \"wall_ns_median\": %llu,\n",
+               (unsigned long long)wall[runs / 2]);
+        printf("      \"statements_per_sec\": %.0f,\n",
+               r[best].statements * 1e9 / wall[0]);
+        printf("      \"ns_per_line\": %.2f,\n",
+               r[best].lines ? (double)wall[0] / r[best].lines : 0.0);
+        printf("      \"peak_rss_kb\": %ld,\n", rss);
+        printf("      \"perf\": ");
+        if (r[best].have_counts) {
+            printf("{");
+            for (size_t i = 0; i < NUM_COUNTERS; i++)
+                printf("%s\"%s\": %llu", i ? ", " : " ", counters[i].name,
+                       (unsigned long long)r[best].counts[i]);
+            printf(" }\n");
+        } else {
+            printf("null\n");
+        }
+        printf("    }");
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,6 @@
+10 LET I = 0
+20 POKE 16, I
+30 LET V = PEEK(I) + PEEK(I + 1)
+40 POKE 21, V
+50 LET I = I + 1
+60 IF I < 20000 THEN GOTO 20
@@ -0,0 +1,6 @@
+10 LET I = 0
+20 PRINT "The quick brown fox jumps over the lazy dog"
+30 PRINT I
+40 PRINT I * 7 - 12345
+50 LET I = I + 1
+60 IF I < 20000 THEN GOTO 20
@@ -0,0 +1,12 @@
+10 LET S = 0
+20 LET N = 0
+30 IF S == 0 THEN LET S = 1 ELSE GOTO 50
+40 GOTO 100
+50 IF S == 1 THEN LET S = 2 ELSE GOTO 70
+60 GOTO 100
+70 IF S == 2 THEN LET S = 3 ELSE GOTO 90
+80 GOTO 100
+90 IF S == 3 THEN LET S = 0
+100 LET N = N + 1
+110 IF N < 30000 THEN GOTO 30
+120 PRINT S
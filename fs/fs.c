@@ -304,6 +304,31 @@ int hw_load(const char *filename, uint8_t *data, uint16_t *len, uint16_t max_len
     return FS_OK;
 }
 
+/* Find a file's data, for reading it in place */
+int hw_open(const char *filename, uint32_t *addr, uint16_t *len) {
+    if (!filename || !addr || !len) {
+        return FS_ERR_INVALID;
+    }
+    
+    fs_init();
+    
+    fs_entry_t entry;
+    uint32_t entry_addr = find_file(filename, &entry, NULL);
+    
+    if (entry_addr == 0) {
+        return FS_ERR_NOT_FOUND;
+    }
+    
+    if (entry.size > 0xFFFF) {
+        return FS_ERR_TOO_LARGE;
+    }
+    
+    *addr = entry_addr + FS_ENTRY_SIZE;
+    *len = entry.size;
+    
+    return FS_OK;
+}
+
 /* List all files */
 void hw_list(void) {
     fs_init();
@@ -29,6 +29,9 @@ int hw_save(const char *filename, uint8_t *data, uint16_t len);
 /* Load a file */
 int hw_load(const char *filename, uint8_t *data, uint16_t *len, uint16_t max_len);
 
+/* Find a file's data in F-RAM without reading it */
+int hw_open(const char *filename, uint32_t *addr, uint16_t *len);
+
 /* List all files to stdout */
 void hw_list(void);
 
@@ -3,13 +3,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "fs.h"
 
 /* Mock F-RAM storage for testing */
 static uint8_t mock_fram[8 * 1024 * 1024];
+static unsigned long fram_reads;
 
 uint8_t fram_read(int addr) {
+    fram_reads++;
     return mock_fram[addr];
 }
 
@@ -21,8 +25,295 @@ void fram_write_enable(void) {
     /* Nothing needed for mock */
 }
 
+#ifdef HIBERNATE_ADDR
+/*
+ * Built together with basic.c (see the Makefile's fs/fs_test target) to
+ * test HIBERNATE against the mock F-RAM. Interpreter output is captured.
+ */
+void basic_yield(uint8_t *line);
+int basic_resume(void);
+
+static char output[1024];
+static int output_len;
+
+void hw_write(const uint8_t *data, uint16_t len) {
+    while (len-- && output_len < (int)sizeof(output) - 1)
+        output[output_len++] = *data++;
+    output[output_len] = '\0';
+}
+
+uint8_t hw_peek(uint8_t addr) { return 0; }
+void hw_poke(uint8_t addr, uint8_t val) { }
+uint32_t hw_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void basic(const char *line) {
+    char buf[64];
+    strcpy(buf, line);
+    basic_yield((uint8_t *)buf);
+}
+
+static int check(const char *what, int ok) {
+    printf("%s: %s\n", what, ok ? "PASS" : "FAIL");
+    return !ok;
+}
+
+/* Put a valid checksum on a snapshot body edited in place */
+static void snap_reseal(void) {
+    uint8_t *h = &mock_fram[HIBERNATE_ADDR];
+    uint16_t len = h[2] | (h[3] << 8), sum = 0;
+
+    for (uint16_t i = 0; i < len; i++)
+        sum = ((sum << 1) | (sum >> 15)) + h[6 + i];
+    h[4] = sum & 0xFF;
+    h[5] = sum >> 8;
+}
+
+/* Hibernate in the middle of a loop, then resume over a changed program */
+static int test_hibernate(void) {
+    int failed = 0;
+
+    basic("10 DIM T(3)");
+    basic("20 FOR I = 1 TO 3");
+    basic("30 LET A = A + I");
+    basic("40 LET T(I) = A");
+    basic("45 LET S$ = S$ + \"AB\"");
+    basic("50 IF I == 2 THEN HIBERNATE");
+    basic("60 NEXT I");
+    basic("70 PRINT A * 100 + T(2)");
+    basic("80 PRINT S$");
+    basic("RUN");
+    failed |= check("Run with HIBERNATE", !strcmp(output, "603\r\nABABAB\r\n"));
+
+    /* Edits made after the snapshot are lost on resume */
+    basic("50");
+    basic("70 PRINT 0");
+    output_len = 0;
+    failed |= check("Resume from snapshot", basic_resume() &&
+                    !strcmp(output, "603\r\nABABAB\r\n"));
+
+    output_len = 0;
+    basic("LIST");
+    failed |= check("Program restored", strstr(output, "70 PRINT A * 100 + T(2)") != NULL);
+
+    /* A damaged snapshot is ignored */
+    mock_fram[HIBERNATE_ADDR + 20] ^= 0xFF;
+    failed |= check("Corrupt snapshot rejected", !basic_resume());
+    mock_fram[HIBERNATE_ADDR + 20] ^= 0xFF;
+
+    basic("HIBERNATE OFF");
+    failed |= check("HIBERNATE OFF", !basic_resume());
+
+    output_len = 0;
+    basic("HIBERNATE");
+    basic("10");
+    failed |= check("HIBERNATE command", basic_resume());
+    output_len = 0;
+    basic("LIST");
+    failed |= check("Stopped program restored", !strncmp(output, "10 DIM T(3)", 11));
+
+    /* A checksummed snapshot with a program larger than this build's */
+    basic("HIBERNATE");
+    mock_fram[HIBERNATE_ADDR + 6 + 1] = 0xFF;
+    mock_fram[HIBERNATE_ADDR + 6 + 2] = 0xFF;
+    snap_reseal();
+    failed |= check("Oversized snapshot rejected", !basic_resume());
+    basic("10 PRINT 7");
+    output_len = 0;
+    basic("LIST");
+    failed |= check("Fresh state after rejection", !strcmp(output, "10 PRINT 7\r\n"));
+    basic("10");
+
+    return failed;
+}
+
+#ifdef LINE_CACHE
+/*
+ * RUN name executes a program straight from the mock F-RAM through the
+ * line cache. The program is several times larger than program[], so it
+ * is entered in parts that each fit, and their SAVEd images are joined.
+ */
+#define PARTS 16
+#define PART_LINES 60
+
+static uint8_t image[16384];
+
+static void clear_program(void) {
+    static uint8_t empty[] = { 'B', 2 };
+    hw_save("EMPTY.BAS", empty, sizeof(empty));
+    basic("LOAD EMPTY.BAS");
+}
+
+/* Join the images of the programs made by part(0) to part(n - 1) */
+static void build(const char *filename, int n, void (*part)(int)) {
+    uint16_t len = 0, got;
+
+    for (int p = 0; p < n; p++) {
+        clear_program();
+        part(p);
+        basic("SAVE PART.BAS");
+        hw_load("PART.BAS", image + len, &got, sizeof(image) - len);
+        len += got - 2;
+    }
+    image[len++] = 'B';
+    image[len++] = 3;
+    hw_save(filename, image, len);
+    clear_program();
+}
+
+/*
+ * Part p is lines 1000 + 100 * p onwards. A FOR loop spans all parts,
+ * each part calls a subroutine longer than the cache and has an IF/ELSE,
+ * and a second task counts alongside.
+ */
+static void big_part(int p) {
+    char line[64];
+    int base = 1000 + 100 * p;
+
+    if (p == 0) {
+        basic("10 LET S = 0");
+        basic("11 LET C = 0");
+        basic("12 LET D = 0");
+        basic("13 LET E = 0");
+        basic("14 LET U = 0");
+        basic("15 LET T = 0");
+        basic("20 TASK 1, 61000");
+        basic("30 FOR I = 1 TO 3");
+    }
+    for (int i = 1; i <= PART_LINES; i++) {
+        if (i == 20)
+            sprintf(line, "%d GOSUB 60000", base + i);
+        else if (i == 40)
+            sprintf(line, "%d IF I == 2 THEN LET D = D + 1 ELSE LET E = E + 1", base + i);
+        else
+            sprintf(line, "%d LET S = S + 1", base + i);
+        basic(line);
+    }
+    if (p == PARTS - 1) {
+        basic("59000 NEXT I");
+        basic("59010 PRINT S");
+        basic("59020 PRINT C");
+        basic("59030 PRINT D * 100 + E");
+        basic("59040 PRINT U");
+        basic("59050 PRINT T");
+        basic("59060 END");
+        basic("60000 LET C = C + I");
+        for (int i = 1; i <= 11; i++) {
+            sprintf(line, "%d LET U = U + 1", 60000 + i);
+            basic(line);
+        }
+        basic("60012 RETURN");
+        basic("61000 FOR J = 1 TO 50");
+        basic("61010 LET T = T + 1");
+        basic("61020 NEXT J");
+    }
+}
+
+/* A loop whose lines stay in the cache: the same program fits program[] */
+static void loop_part(int p) {
+    basic("5 LET A = 0");
+    basic("10 FOR I = 1 TO 5000");
+    basic("20 GOSUB 100");
+    basic("30 NEXT I");
+    basic("40 PRINT A");
+    basic("50 END");
+    basic("100 LET A = A + I");
+    basic("110 RETURN");
+}
+
+static unsigned long stat(const char *name) {
+    char *p = strstr(output, name);
+    return p ? strtoul(p + 11, NULL, 10) : 0;
+}
+
+static int test_line_cache(void) {
+    int failed = 0;
+    char want[64];
+
+    build("BIG.BAS", PARTS, big_part);
+    output_len = 0;
+    basic("RUN BIG.BAS");
+    sprintf(want, "%d\r\n%d\r\n%d\r\n%d\r\n50\r\n",
+            3 * (PART_LINES - 2) * PARTS, 6 * PARTS, 102 * PARTS, 33 * PARTS);
+    failed |= check("RUN from F-RAM", !strcmp(output, want));
+
+
+    output_len = 0;
+    basic("STATS");
+    /* With a slot to spare, straight-line code misses every other line:
+       the other was read ahead */
+    failed |= check("Cache counters", stat("CACHE HITS") > 0 &&
+                    stat("CACHE MISS") > 0 && (LINE_CACHE < 3 ||
+                    stat("CACHE MISS") * 3 < stat("LINES RUN") * 2));
+
+    output_len = 0;
+    basic("RUN NOPE.BAS");
+    failed |= check("RUN missing file", !strcmp(output, "Error running NOPE.BAS\r\n"));
+
+    /* A SAVEd program runs the same from F-RAM and from program[] */
+    build("LOOP.BAS", 1, loop_part);
+    output_len = 0;
+    basic("RUN LOOP.BAS");
+    strcpy(want, output);
+    basic("LOAD LOOP.BAS");
+    output_len = 0;
+    basic("RUN");
+    failed |= check("Same result as LOAD and RUN", !strcmp(output, want) &&
+                    strcmp(want, "0\r\n"));
+
+    return failed;
+}
+
+/* Time a program from program[] and from F-RAM, with the cache counters */
+static void bench_run(const char *name, void (*part)(int), int parts) {
+    static const char *how[] = { "program[]", "F-RAM" };
+    char cmd[32];
+
+    build(name, parts, part);
+    for (int from_file = parts == 1 ? 0 : 1; from_file < 2; from_file++) {
+        if (from_file) {
+            sprintf(cmd, "RUN %s", name);
+        } else {
+            sprintf(cmd, "LOAD %s", name);
+            basic(cmd);
+            strcpy(cmd, "RUN");
+        }
+        basic("STATS RESET");
+        fram_reads = 0;
+        uint32_t start = hw_ticks();
+        basic(cmd);
+        uint32_t us = hw_ticks() - start;
+        unsigned long reads = fram_reads;
+        output_len = 0;
+        basic("STATS");
+        printf("%-9s %-10s %8lu %8lu %8lu %10lu %8u\n", name, how[from_file],
+               stat("LINES RUN"), stat("CACHE HITS"), stat("CACHE MISS"),
+               reads, (unsigned)us);
+    }
+}
+
+static void bench_line_cache(void) {
+    printf("LINE_CACHE=%d\n", LINE_CACHE);
+    printf("%-9s %-10s %8s %8s %8s %10s %8s\n", "program", "from",
+           "lines", "hits", "misses", "F-RAM rd", "us");
+    bench_run("BIG.BAS", big_part, PARTS);
+    bench_run("LOOP.BAS", loop_part, 1);
+}
+#endif
+#endif
+
 /* Test the filesystem */
-int main(void) {
+int main(int argc, char **argv) {
+#ifdef LINE_CACHE
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bench_line_cache();
+        return 0;
+    }
+#endif
+
     printf("=== F-RAM Filesystem Test ===\n\n");
     
     /* Initialize filesystem */
@@ -140,6 +431,15 @@ int main(void) {
     printf("\nAfter adding many files:\n");
     hw_list();
     
+#ifdef HIBERNATE_ADDR
+    printf("\n--- Testing HIBERNATE ---\n");
+    if (test_hibernate()) return 1;
+#endif
+#ifdef LINE_CACHE
+    printf("\n--- Testing RUN from F-RAM ---\n");
+    if (test_line_cache()) return 1;
+#endif
+
     printf("\n=== Test Complete ===\n");
     return 0;
 }
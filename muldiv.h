@@ -0,0 +1,132 @@
+/*
+ * Machdyne BASIC - 16-bit multiply and divide kernels
+ * Copyright (c) 2025 Lone Dynamics Corporation. All rights reserved.
+ *
+ */
+
+#ifndef MULDIV_H
+#define MULDIV_H
+
+#include <stdint.h>
+
+// Cores without a hardware multiplier (the CH32V003 is RV32EC) turn every
+// C '*' and '/' into a libgcc call working on 32-bit operands. These
+// kernels only handle the 16-bit values BASIC has, and give the same
+// results as int16_t arithmetic in C: products wrap, quotients truncate
+// toward zero and -32768 / -1 is -32768. Division by zero is left to the
+// caller.
+
+// Low 16 bits of a * b by shift and add, looping over the smaller
+// magnitude so small factors finish early
+static inline int16_t mul16(int16_t a, int16_t b) {
+    uint16_t x = a < 0 ? -(uint16_t)a : (uint16_t)a;
+    uint16_t y = b < 0 ? -(uint16_t)b : (uint16_t)b;
+    uint16_t r = 0;
+
+    if (x < y) {
+        uint16_t t = x;
+        x = y;
+        y = t;
+    }
+    while (y) {
+        if (y & 1) r += x;
+        x <<= 1;
+        y >>= 1;
+    }
+    return (a ^ b) < 0 ? -r : r;
+}
+
+// Full 32-bit product of two 16-bit unsigned values
+static inline uint32_t umul16x16(uint16_t a, uint16_t b) {
+    uint32_t x = a;
+    uint32_t r = 0;
+
+    while (b) {
+        if (b & 1) r += x;
+        x <<= 1;
+        b >>= 1;
+    }
+    return r;
+}
+
+// n / d by restoring division, one quotient bit per step. Leading zero
+// bits of n are skipped, as they only shift zeros into the remainder.
+static inline uint16_t udiv16(uint16_t n, uint16_t d) {
+    uint32_t r = 0;
+    uint8_t bits = 16;
+
+    while (bits && !(n & 0x8000)) {
+        n <<= 1;
+        bits--;
+    }
+    while (bits--) {
+        r = (r << 1) | (n >> 15);
+        n <<= 1;
+        if (r >= d) {
+            r -= d;
+            n |= 1;
+        }
+    }
+    return n;
+}
+
+static inline int16_t div16(int16_t a, int16_t b) {
+    uint16_t x = a < 0 ? -(uint16_t)a : (uint16_t)a;
+    uint16_t y = b < 0 ? -(uint16_t)b : (uint16_t)b;
+    uint16_t q = udiv16(x, y);
+
+    return (a ^ b) < 0 ? -q : q;
+}
+
+/* ================= DIVISION BY A CONSTANT ================= */
+
+// A constant divisor d is replaced by a multiplier m and a shift k with
+// n / |d| == (n * m) >> k for every magnitude n up to 32768: k is
+// 15 + ceil(log2 |d|) and m is 2^k / |d| rounded up, which always fits in
+// 16 bits. The sign of d is kept in bit 7 of the shift byte.
+#define DIVC_NEG 0x80
+
+static inline uint16_t divc_magic(int16_t d, uint8_t *shift) {
+    uint16_t y = d < 0 ? -(uint16_t)d : (uint16_t)d;
+    uint8_t k = 15;
+
+    while (k < 31 && ((uint32_t)1 << (k - 15)) < y) k++;
+    *shift = k | (d < 0 ? DIVC_NEG : 0);
+    return ((uint32_t)1 << k) / y + (((uint32_t)1 << k) % y != 0);
+}
+
+// The divisor behind (m, shift), for LIST. 2^k / m is |d| or one less,
+// and only |d| gives back the same multiplier.
+static inline int16_t divc_divisor(uint16_t m, uint8_t shift) {
+    uint8_t k = shift & ~DIVC_NEG, s;
+    uint16_t y = ((uint32_t)1 << k) / m;
+
+    if (divc_magic(y, &s) != m || (s & ~DIVC_NEG) != k) y++;
+    return shift & DIVC_NEG ? -y : y;
+}
+
+// Used automatically when the compiler targets RISC-V without the M
+// extension; -DSOFT_MULDIV forces them elsewhere.
+#if !defined(SOFT_MULDIV) && defined(__riscv) && !defined(__riscv_mul)
+#define SOFT_MULDIV
+#endif
+
+#ifdef SOFT_MULDIV
+#define MUL16(a, b)      mul16(a, b)
+#define DIV16(a, b)      div16(a, b)
+#define UMUL16X16(a, b)  umul16x16(a, b)
+#else
+#define MUL16(a, b)      ((int16_t)((a) * (b)))
+#define DIV16(a, b)      ((int16_t)((a) / (b)))
+#define UMUL16X16(a, b)  ((uint32_t)(a) * (b))
+#endif
+
+// n divided by the constant behind (m, shift)
+static inline int16_t divc(int16_t n, uint16_t m, uint8_t shift) {
+    uint16_t x = n < 0 ? -(uint16_t)n : (uint16_t)n;
+    uint16_t q = UMUL16X16(x, m) >> (shift & ~DIVC_NEG);
+
+    return (n < 0) != !!(shift & DIVC_NEG) ? -q : q;
+}
+
+#endif
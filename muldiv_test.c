@@ -0,0 +1,51 @@
+/*
+ * Exhaustive test of the multiply and divide kernels against native
+ * int16_t arithmetic: every pair of 16-bit operands, and every dividend
+ * for every constant divisor, which must also be recovered from its
+ * multiplier and shift.
+ */
+
+#include <stdio.h>
+#include "muldiv.h"
+
+int main(void) {
+    unsigned long errors = 0;
+
+    for (int32_t a = -32768; a <= 32767; a++) {
+        for (int32_t b = -32768; b <= 32767; b++) {
+            int16_t p = (int16_t)(a * b);
+            if (mul16(a, b) != p) {
+                if (errors++ < 10) printf("mul16(%d, %d) = %d, expected %d\n",
+                                          a, b, mul16(a, b), p);
+            }
+            if (b == 0) continue;
+            int16_t q = (int16_t)(a / b);
+            if (div16(a, b) != q) {
+                if (errors++ < 10) printf("div16(%d, %d) = %d, expected %d\n",
+                                          a, b, div16(a, b), q);
+            }
+        }
+    }
+    printf("mul16/div16: %s\n", errors ? "FAIL" : "PASS");
+
+    unsigned long divc_errors = 0;
+    for (int32_t d = -32768; d <= 32767; d++) {
+        if (d == 0) continue;
+        uint8_t shift;
+        uint16_t m = divc_magic(d, &shift);
+        if (divc_divisor(m, shift) != d) {
+            if (divc_errors++ < 10) printf("divc_divisor(%u, %u) = %d, expected %d\n",
+                                           m, shift, divc_divisor(m, shift), d);
+        }
+        for (int32_t n = -32768; n <= 32767; n++) {
+            int16_t q = (int16_t)(n / d);
+            if (divc(n, m, shift) != q) {
+                if (divc_errors++ < 10) printf("divc(%d, %d) = %d, expected %d\n",
+                                               n, d, divc(n, m, shift), q);
+            }
+        }
+    }
+    printf("divc: %s\n", divc_errors ? "FAIL" : "PASS");
+
+    return errors || divc_errors;
+}
@@ -0,0 +1,214 @@
+#!/bin/bash
+# Worst-case C stack per interpreter entry point and static RAM, from
+# GCC's -fstack-usage/-fcallgraph-info output and a linker map.
+#
+# Usage: ramreport.sh [-c cc] [-m target.map] [-r sram] -- [cflags...]
+#
+# basic.c is compiled with cc (gcc by default) and the given flags, which
+# should be the target's own. The stack of each basic_* entry point is its
+# deepest call chain; a chain that comes back to a function it already
+# holds is cut there, and each such cycle is listed with the stack one
+# trip around it takes. The expression evaluators recurse at most
+# EXPR_DEPTH levels, which gives the bound: the deepest chain that reaches
+# a cycle plus the further trips, or the deepest chain of all if that is
+# more (line entry, say, never recurses). Calls out of basic.c (hw_*,
+# print, libc, the write hook) are not counted. With -m, the .data and
+# .bss of every object in the linked target are added up from its map.
+# With -r as well, the script fails if they and the stack bound come to
+# more than sram bytes.
+
+CC=gcc
+MAP=
+SRAM=
+
+while getopts "c:m:r:" opt; do
+    case $opt in
+        c) CC=$OPTARG ;;
+        m) MAP=$OPTARG ;;
+        r) SRAM=$OPTARG ;;
+        *) echo "Usage: $0 [-c cc] [-m target.map] [-r sram] -- [cflags...]"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+SRC=$(cd "$(dirname "$0")" && pwd)/basic.c
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+(cd "$TMP" && $CC "$@" -fstack-usage -fcallgraph-info=su -c "$SRC" -o basic.o) || exit 1
+
+# EXPR_DEPTH as built: from the flags, else the default in basic.c
+DEPTH=$(printf "%s\n" "$@" | sed -n 's/^-DEXPR_DEPTH=//p' | tail -1)
+[ -z "$DEPTH" ] && DEPTH=$(sed -n 's/^#define EXPR_DEPTH \([0-9]*\).*/\1/p' "$SRC")
+
+echo "=== C stack (bytes) ==="
+awk -v depth="$DEPTH" -v out="$TMP/stack" '
+/^node:/ {
+    match($0, /title: "[^"]*"/)
+    t = substr($0, RSTART + 8, RLENGTH - 9)
+    match($0, /label: "[^\\"]*/)
+    name[t] = substr($0, RSTART + 8, RLENGTH - 8)
+    if (match($0, /[0-9]+ bytes/)) size[t] = substr($0, RSTART, RLENGTH - 6) + 0
+    else external[t] = 1
+}
+/^edge:/ {
+    match($0, /sourcename: "[^"]*"/)
+    s = substr($0, RSTART + 13, RLENGTH - 14)
+    match($0, /targetname: "[^"]*"/)
+    d = substr($0, RSTART + 13, RLENGTH - 14)
+    if (!((s, d) in seen)) {
+        seen[s, d] = 1
+        kids[s, ++nkids[s]] = d
+    }
+}
+
+# Deepest chain below t, cutting recursion at functions already on it
+function worst(t,    i, c, w, best, sum, k, key) {
+    if (t in memo) return memo[t]
+    path[++sp] = t
+    on[t] = sp
+    best = 0
+    for (i = 1; i <= nkids[t]; i++) {
+        c = kids[t, i]
+        if (on[c]) {
+            sum = 0
+            key = ""
+            for (k = on[c]; k <= sp; k++) {
+                sum += size[path[k]]
+                key = key name[path[k]] " > "
+                member[path[k]] = 1
+            }
+            cycle[key name[c]] = sum
+            continue
+        }
+        w = worst(c)
+        if (w > best) {
+            best = w
+            via[t] = c
+        }
+    }
+    on[t] = 0
+    sp--
+    memo[t] = size[t] + best
+    return memo[t]
+}
+
+# Deepest chain below t that enters a cycle, -1 if none does
+function reaching(t,    i, c, r, best) {
+    if (t in rmemo) return rmemo[t]
+    if (t in member) return rmemo[t] = memo[t]
+    ron[t] = 1
+    best = -1
+    for (i = 1; i <= nkids[t]; i++) {
+        c = kids[t, i]
+        if (ron[c]) continue
+        r = reaching(c)
+        if (r > best) best = r
+    }
+    ron[t] = 0
+    return rmemo[t] = best < 0 ? -1 : size[t] + best
+}
+
+END {
+    for (t in name)
+        if (name[t] ~ /^basic_/ && !(t in external)) entry[name[t]] = t
+    n = 0
+    for (e in entry) order[++n] = e
+    for (i = 2; i <= n; i++)
+        for (j = i; j > 1 && order[j - 1] > order[j]; j--) {
+            x = order[j]; order[j] = order[j - 1]; order[j - 1] = x
+        }
+
+    deepest = 0
+    for (i = 1; i <= n; i++) {
+        t = entry[order[i]]
+        w = worst(t)
+        if (w > deepest) deepest = w
+        chain = name[t]
+        for (c = via[t]; c != ""; c = via[c]) chain = chain " > " name[c]
+        printf "%-20s %6d  %s\n", order[i], w, chain
+    }
+
+    # The chains above already hold one trip around a cycle
+    most = 0
+    for (k in cycle) {
+        printf "recursion            %6d  %s\n", cycle[k], k
+        if (cycle[k] > most) most = cycle[k]
+    }
+    extra = most && depth > 1 ? (depth - 1) * most : 0
+    bound = deepest
+    if (most) {
+        printf "EXPR_DEPTH=%d adds at most %d x %d = %d to chains that recurse\n",
+               depth, depth - 1, most, extra
+        for (i = 1; i <= n; i++) {
+            w = reaching(entry[order[i]])
+            if (w >= 0 && w + extra > bound) bound = w + extra
+        }
+    }
+    printf "bound                %6d\n", bound
+    print bound > out
+
+    for (t in external) {
+        if (name[t] == "" || t == "__indirect_call") continue
+        list = list " " name[t]
+    }
+    if (list != "") print "not counted:" list
+}' "$TMP"/basic.ci
+
+NM=${CC%gcc}nm
+SIZE=${CC%gcc}size
+
+echo
+echo "=== Static RAM of basic.o (bytes) ==="
+$SIZE -A "$TMP"/basic.o | awk '
+$1 ~ /^\.s?(data|bss)/ { ram += $2; printf "%-24s %8d\n", $1, $2 }
+END { printf "%-24s %8d\n", "total", ram }'
+echo "largest:"
+$NM -S --size-sort -t d "$TMP"/basic.o | awk '$3 ~ /[bBdDsSgG]/' | tail -5 |
+    awk '{ printf "  %-22s %8d\n", $4, $2 }'
+
+[ -z "$MAP" ] && exit 0
+
+echo
+echo "=== Static RAM by object, from $(basename "$MAP") (bytes) ==="
+awk '
+function hex(s,    i, n) {
+    n = 0
+    s = tolower(substr(s, 3))
+    for (i = 1; i <= length(s); i++)
+        n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+    return n
+}
+
+# Input sections: " .bss.name 0xaddr 0xsize object", with the address
+# and size on a line of their own when the name is long
+/^ (\.s?(data|bss)|COMMON)/ {
+    if (NF >= 4) { size = $3; obj = $4 }
+    else if (NF == 1) {
+        if ((getline line) <= 0) next
+        split(line, f)
+        size = f[2]; obj = f[3]
+    } else next
+    if (size !~ /^0x/) next
+    n = hex(size)
+    sub(/.*\//, "", obj)
+    ram[obj] += n
+    total += n
+}
+END {
+    for (o in ram) if (ram[o]) printf "%-32s %8d\n", o, ram[o]
+    printf "%-32s %8d\n", "total", total
+}' "$MAP" | sort -k2 -n | tee "$TMP"/ram
+
+[ -z "$SRAM" ] && exit 0
+
+STATIC=$(awk '$1 == "total" { print $2 }' "$TMP"/ram)
+STACK=$(cat "$TMP"/stack)
+echo
+echo "=== SRAM (bytes) ==="
+printf "%-32s %8d\n" "static" "$STATIC" "stack bound" "$STACK" \
+    "free of $SRAM" $((SRAM - STATIC - STACK))
+if [ $((STATIC + STACK)) -gt "$SRAM" ]; then
+    echo "static RAM and stack exceed $SRAM bytes of SRAM"
+    exit 1
+fi
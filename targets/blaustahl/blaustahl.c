@@ -27,6 +27,9 @@ void fs_init(void);
 void hw_list(void);
 
 void basic_yield(uint8_t *line);
+void basic_break(void);
+int basic_step(uint32_t max_statements, uint32_t max_us);
+int basic_resume(void);
 
 uint8_t booting = 1;
 
@@ -58,7 +61,11 @@ int main(void) {
 
    hw_list();
 
-	add_alarm_in_ms(3000, timer_callback, NULL, false);
+	// carry on from a HIBERNATE snapshot instead of loading BOOT.BAS
+	if (basic_resume())
+		booting = 0;
+	else
+		add_alarm_in_ms(3000, timer_callback, NULL, false);
 
 	// parser
    char buf[BUFLEN];
@@ -70,7 +77,16 @@ int main(void) {
 	// wait for commands
 	while (1) {
 
-		c = getchar();
+		// run the program for up to 1 ms at a time (and wake it from
+		// SLEEP), so USB and the console are served while it runs
+		basic_step(0, 1000);
+
+		c = getchar_timeout_us(0);
+
+		if (c == 0x03) {	// Ctrl-C stops the program
+			basic_break();
+			continue;
+		}
 
 		if (c > 0) {
 
@@ -107,8 +123,13 @@ int main(void) {
 
 }
 
-void hw_sleep(uint16_t secs) {
-   sleep_ms(secs * 1000);
+void hw_write(const uint8_t *data, uint16_t len) {
+   fwrite(data, 1, len, stdout);
+   fflush(stdout);
+}
+
+uint32_t hw_ticks(void) {
+   return time_us_32();
 }
 
 uint8_t hw_peek(uint8_t addr) {
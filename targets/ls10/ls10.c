@@ -7,15 +7,19 @@
 
 //#define RX_BUF_LEN 16 // size of receive circular buffer
 #define RX_BUF_LEN 128 // size of receive circular buffer
+#define CMD_BUF_LEN 64 // longest command basic_yield() takes (MAX_LINE)
 
 uint8_t rx_buf[RX_BUF_LEN] = {0}; // DMA receive buffer for incoming data
-uint8_t cmd_buf[RX_BUF_LEN] = {0}; // buffer for complete command strings
+uint8_t cmd_buf[CMD_BUF_LEN] = {0}; // buffer for complete command strings
 
 void fram_init(void);
 void fs_init(void);
 void hw_list(void);
 
 void basic_yield(uint8_t *line);
+void basic_break(void);
+int basic_step(uint32_t max_statements, uint32_t max_us);
+int basic_resume(void);
 
 int main()
 {
@@ -56,7 +60,8 @@ int main()
 	// EN: 1 (enable DMA)
 	DMA1_Channel5->CFGR = DMA_CFGR1_CIRC | DMA_CFGR1_MINC | DMA_CFGR1_EN;
 
-   u32 bootctr = 1;
+   // carry on from a HIBERNATE snapshot instead of loading BOOT.BAS
+   u32 bootctr = basic_resume() ? 0 : 1;
 
 	while(1)
 	{
@@ -72,6 +77,10 @@ int main()
 
 		if (bootctr) ++bootctr;
 
+		// run the program a slice at a time (and wake it from SLEEP),
+		// so the DMA ring is drained while it runs
+		basic_step(64, 0);
+
 		// calculate head position based on DMA counter (modulo when DMA1_Channel5->CNTR = 0)
 		u32 head = (RX_BUF_LEN - DMA1_Channel5->CNTR) % RX_BUF_LEN; // current write position in rx_buf
 		
@@ -81,6 +90,13 @@ int main()
 
 			bootctr = 0;	// disable boot
 
+			if (rx_buf[tail] == 0x03) {	// Ctrl-C stops the program
+				basic_break();
+				cmd_st = (tail + 1) % RX_BUF_LEN;
+				tail = cmd_st;
+				continue;
+			}
+
 			putchar(rx_buf[tail]); // echo			
 			if (rx_buf[tail] == '\r') putchar('\n');
 
@@ -88,16 +104,17 @@ int main()
 			{
 				cmd_end = tail;
 				u32 cmd_i = 0; // carret position in cmd_buf
+				// longer commands are cut to fit cmd_buf
 				if (cmd_end > cmd_st)
 				{
-					for (u32 rx_i = cmd_st; rx_i < cmd_end + 1; rx_i++, cmd_i++) {
+					for (u32 rx_i = cmd_st; rx_i < cmd_end + 1 && cmd_i < CMD_BUF_LEN - 1; rx_i++, cmd_i++) {
 						cmd_buf[cmd_i] = rx_buf[rx_i];
 					}
 				} else if (cmd_st > cmd_end) { // handle wrap around
-					for (u32 rx_i = cmd_st; rx_i < RX_BUF_LEN; rx_i++, cmd_i++) {
+					for (u32 rx_i = cmd_st; rx_i < RX_BUF_LEN && cmd_i < CMD_BUF_LEN - 1; rx_i++, cmd_i++) {
 						cmd_buf[cmd_i] = rx_buf[rx_i];
 					}
-					for (u32 rx_i = 0; rx_i < cmd_end + 1; rx_i++, cmd_i++) {
+					for (u32 rx_i = 0; rx_i < cmd_end + 1 && cmd_i < CMD_BUF_LEN - 1; rx_i++, cmd_i++) {
 						cmd_buf[cmd_i] = rx_buf[rx_i];
 					}
 				}
@@ -144,8 +161,25 @@ int atoi(const char *str) {
     return sign * result;
 }
 
-void hw_sleep(uint16_t secs) {
-	Delay_Ms(secs * 1000);
+int _write(int fd, const char *buf, int size);
+
+void hw_write(const uint8_t *data, uint16_t len) {
+	_write(0, (const char *)data, len);
+}
+
+// SysTick counts core clocks, so dividing it down wraps long before 2^32
+// microseconds; accumulate instead so differences of ticks stay valid.
+// Needs a call at least once per SysTick wrap, which the main loop's
+// basic_step() provides.
+uint32_t hw_ticks(void) {
+	static uint32_t last, frac, us;
+	uint32_t now = SysTick->CNT;
+
+	frac += now - last;
+	last = now;
+	us += frac / DELAY_US_TIME;
+	frac %= DELAY_US_TIME;
+	return us;
 }
 
 uint8_t hw_peek(uint8_t addr) {
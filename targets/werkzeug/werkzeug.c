@@ -20,6 +20,10 @@
 
 #define BUFLEN 128
 
+void basic_yield(uint8_t *line);
+void basic_break(void);
+int basic_step(uint32_t max_statements, uint32_t max_us);
+
 int main(void) {
 
 	stdio_init_all();
@@ -46,7 +50,16 @@ int main(void) {
 	// wait for commands
 	while (1) {
 
-		c = getchar();
+		// run the program for up to 1 ms at a time (and wake it from
+		// SLEEP), so USB and the console are served while it runs
+		basic_step(0, 1000);
+
+		c = getchar_timeout_us(0);
+
+		if (c == 0x03) {	// Ctrl-C stops the program
+			basic_break();
+			continue;
+		}
 
 		if (c > 0) {
 
@@ -79,8 +92,13 @@ int main(void) {
 
 }
 
-void hw_sleep(uint16_t secs) {
-   sleep_ms(secs * 1000);
+void hw_write(const uint8_t *data, uint16_t len) {
+   fwrite(data, 1, len, stdout);
+   fflush(stdout);
+}
+
+uint32_t hw_ticks(void) {
+   return time_us_32();
 }
 
 uint8_t hw_peek(uint8_t addr) {
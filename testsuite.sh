@@ -18,7 +18,7 @@ TOTAL=0
 # Compile the interpreter
 compile_basic() {
     echo "Compiling BASIC interpreter..."
-    gcc -DTARGET_LINUX -o basic basic.c 2>&1
+    gcc $CFLAGS -DTARGET_LINUX -o basic basic.c -pthread 2>&1
     if [ $? -ne 0 ]; then
         echo -e "${RED}FATAL: Failed to compile basic.c${NC}"
         exit 1
@@ -184,6 +184,32 @@ RUN" \
 2
 3"
 
+run_test "GOTO missing line continues" \
+"10 GOTO 25
+20 PRINT \"Next\"
+RUN" \
+"Next"
+
+run_test "GOTO after line edit" \
+"10 GOTO 30
+20 PRINT \"Skip\"
+30 PRINT \"Old\"
+RUN
+30 PRINT \"New\"
+5 PRINT \"Start\"
+RUN" \
+"Old
+Start
+New"
+
+run_test "GOTO computed target" \
+"10 LET A = 3
+20 GOTO A * 10 + 10
+30 PRINT \"Thirty\"
+40 PRINT \"Forty\"
+RUN" \
+"Forty"
+
 # ============================================================
 section "IF/THEN Statement"
 # ============================================================
@@ -234,6 +260,25 @@ run_test "IF THEN ELSE with multiple statements" \
 RUN" \
 "1"
 
+run_test "IF without comparison is false" \
+"10 LET A = 1
+20 IF A THEN PRINT \"Yes\" ELSE PRINT \"No\"
+RUN" \
+"No"
+
+run_test "IF THEN ELSE alternating in a loop" \
+"10 LET A = 0
+20 LET B = 0
+30 IF A == 0 THEN LET A = 1 ELSE LET A = 0
+40 PRINT A
+50 LET B = B + 1
+60 IF B < 4 THEN GOTO 30
+RUN" \
+"1
+0
+1
+0"
+
 # ============================================================
 section "Comparison Operators"
 # ============================================================
@@ -275,6 +320,236 @@ run_test "Comparison with variables" \
 RUN" \
 "A bigger"
 
+# ============================================================
+section "FOR/NEXT Loops"
+# ============================================================
+
+run_test "FOR/NEXT counting" \
+"10 FOR I = 1 TO 3
+20 PRINT I
+30 NEXT I
+40 PRINT I
+RUN" \
+"1
+2
+3
+4"
+
+run_test "FOR/NEXT nested with STEP" \
+"10 FOR I = 1 TO 2
+20 FOR J = 10 TO 0 STEP -5
+30 PRINT I * 100 + J
+40 NEXT J
+50 NEXT I
+RUN" \
+"110
+105
+100
+210
+205
+200"
+
+run_test "FOR/NEXT early exit by GOTO" \
+"10 FOR N = 1 TO 3
+20 FOR K = 1 TO 100
+30 IF K == N THEN GOTO 50
+40 NEXT K
+50 PRINT K
+60 NEXT N
+RUN" \
+"1
+2
+3"
+
+run_test "FOR/NEXT in LIST" \
+"10 FOR I = 10 TO 0 STEP 0-2
+20 NEXT I
+LIST" \
+"10 FOR I = 10 TO 0 STEP (-2)
+20 NEXT I"
+
+run_test "NEXT without FOR" \
+"10 PRINT 1
+20 NEXT I
+30 PRINT 2
+RUN" \
+"1
+Error: NEXT without FOR in line 20"
+
+# ============================================================
+section "GOSUB/RETURN"
+# ============================================================
+
+run_test "GOSUB and RETURN" \
+"10 FOR I = 1 TO 3
+20 GOSUB 100
+30 NEXT I
+40 END
+100 PRINT I * 10
+110 RETURN
+RUN" \
+"10
+20
+30"
+
+run_test "GOSUB from IF clause" \
+"10 LET A = 1
+20 IF A == 1 THEN GOSUB 100 : PRINT 2 ELSE PRINT 3
+30 GOSUB 200
+40 END
+100 PRINT 1
+110 RETURN
+200 GOSUB 100
+210 PRINT 4
+220 RETURN
+RUN" \
+"1
+2
+1
+4"
+
+run_test "RETURN without GOSUB" \
+"10 PRINT 1
+20 RETURN
+RUN" \
+"1
+Error: RETURN without GOSUB in line 20"
+
+run_test "GOSUB nested too deeply" \
+"10 GOSUB 10
+RUN" \
+"Error: GOSUB nested too deeply in line 10"
+
+# ============================================================
+section "DIM Arrays"
+# ============================================================
+
+run_test "DIM store and fetch" \
+"10 DIM A(5), B(2)
+20 FOR I = 0 TO 5
+30 LET A(I) = I * I
+40 NEXT I
+50 LET B(A(1) + 1) = 7
+60 LET A = 100
+70 PRINT A(5) + A(2) + A
+80 PRINT B(2) + B(0)
+RUN" \
+"129
+7"
+
+run_test "DIM subscript out of range" \
+"10 DIM A(3)
+20 PRINT A(3)
+30 PRINT A(4)
+40 PRINT 9
+RUN" \
+"0
+Error: Subscript out of range in line 30"
+
+run_test "DIM released at RUN" \
+"10 DIM A(2)
+20 LET A(2) = A(2) + 1
+30 PRINT A(2)
+RUN
+RUN" \
+"1
+1"
+
+run_test "DIM out of array memory" \
+"10 DIM A(30000)
+RUN" \
+"Error: Out of array memory in line 10"
+
+run_test "DIM in LIST" \
+"10 DIM A(9), B(2 * 3)
+20 LET A(B(1)) = A(0) + 1
+LIST" \
+"10 DIM A(9), B(6)
+20 LET A(B(1)) = A(0) + 1"
+
+# ============================================================
+section "SLEEP"
+# ============================================================
+
+run_test "SLEEP resumes mid-line" \
+"10 LET A = 1
+20 IF A == 1 THEN SLEEP 1 PRINT 2 ELSE PRINT 3
+30 PRINT 4
+RUN" \
+"2
+4"
+
+run_test "Lines typed during SLEEP wait for the program" \
+"10 PRINT 1
+20 SLEEP 1
+30 PRINT 2
+RUN
+LIST" \
+"1
+2
+10 PRINT 1
+20 SLEEP 1
+30 PRINT 2"
+
+run_test "Break during SLEEP" \
+"10 PRINT 1
+20 SLEEP 5
+30 PRINT 2
+RUN
+$(printf '\003')
+LIST" \
+"1
+Break in line 20
+10 PRINT 1
+20 SLEEP 5
+30 PRINT 2"
+
+# ============================================================
+section "TASK"
+# ============================================================
+
+run_test "TASK runs while another sleeps" \
+"10 TASK 1, 100
+20 PRINT 1
+30 SLEEP 1
+40 PRINT 3
+50 END
+100 PRINT 2
+RUN" \
+"1
+2
+3"
+
+run_test "TASK loops take turns" \
+"10 TASK 1, 100
+20 FOR I = 1 TO 100: LET A = A + 1: NEXT I
+30 IF B < 100 THEN GOTO 30
+40 PRINT A + B
+50 END
+100 FOR J = 1 TO 100: LET B = B + 1: NEXT J
+RUN" \
+"200"
+
+run_test "TASK stopped by another" \
+"10 TASK 1, 100
+20 IF A < 50 THEN GOTO 20
+30 TASK 1
+40 LET B = A
+50 FOR I = 1 TO 50: NEXT I
+60 IF A == B THEN PRINT \"STOPPED\"
+70 END
+100 LET A = A + 1
+110 GOTO 100
+RUN" \
+"STOPPED"
+
+run_test "Bad task number" \
+"10 TASK 1, 100
+20 END
+100 TASK 1
+RUN" \
+"Error: Bad task number in line 100"
+
 # ============================================================
 section "END Statement"
 # ============================================================
@@ -376,6 +651,108 @@ run_test "String with numbers" \
 RUN" \
 "Test 123"
 
+run_test "String variables and concatenation" \
+"10 LET A\$ = \"Hello\"
+20 LET B\$ = A\$ + \", \" + \"World\"
+30 LET A\$ = B\$
+40 PRINT A\$ + \"!\"
+RUN" \
+"Hello, World!"
+
+run_test "LEN and MID\$" \
+"10 LET A\$ = \"MACHDYNE\"
+20 PRINT LEN(A\$)
+30 PRINT MID\$(A\$, 5, 3)
+40 PRINT MID\$(A\$ + \" BASIC\", 10)
+50 PRINT LEN(MID\$(A\$, 7, 10)) * 10
+60 PRINT LEN(\"\")
+RUN" \
+"8
+DYN
+BASIC
+20
+0"
+
+run_test "String comparisons" \
+"10 LET A\$ = \"ABC\"
+20 IF A\$ == \"ABC\" THEN PRINT \"EQ\"
+30 IF A\$ < \"ABD\" THEN PRINT \"LT\"
+40 IF A\$ > \"AB\" THEN PRINT \"GT\"
+50 IF MID\$(A\$, 2) <> \"BC\" THEN PRINT \"NE\" ELSE PRINT \"SAME\"
+RUN" \
+"EQ
+LT
+GT
+SAME"
+
+run_test "String arena compaction" \
+"10 LET A\$ = \"KEEP\"
+20 FOR I = 1 TO 500
+30 LET B\$ = MID\$(B\$ + A\$ + \"XY\", 1, 20)
+40 NEXT I
+50 PRINT A\$
+60 PRINT B\$
+70 IF PEEK(252) > 0 THEN PRINT \"COLLECTED\"
+80 PRINT PEEK(251)
+RUN" \
+"KEEP
+KEEPXYKEEPXYKEEPXYKE
+COLLECTED
+50"
+
+run_test "String errors" \
+"10 LET A = A\$
+RUN
+10 LET A\$ = 1
+RUN
+10 LET A\$ = \"0123456789ABCDEF\"
+20 LET A\$ = A\$ + A\$
+30 GOTO 20
+RUN" \
+"Error: Type mismatch in line 10
+Error: Type mismatch in line 10
+Error: String too long in line 20"
+
+run_test "String variables in LIST" \
+"10 LET N\$ = MID\$(A\$ + \"X\", 1, LEN(A\$))
+LIST" \
+"10 LET N\$ = MID\$(A\$ + \"X\", 1, LEN(A\$))"
+
+# ============================================================
+section "Memory"
+# ============================================================
+
+run_test "FRE" \
+"10 DIM A(10)
+20 LET A\$ = \"ABC\"
+30 PRINT FRE(1)
+40 PRINT FRE(2)
+50 PRINT FRE(3)
+RUN" \
+"1013
+1021
+0"
+
+run_test "Dense line storage" \
+"10 PRINT FRE(0)
+RUN" \
+"1015"
+
+run_test "Expression nesting limit" \
+"10 LET A = 7
+20 PRINT (((((((((((((((A)))))))))))))))
+30 PRINT ((((((((((((((((A))))))))))))))))
+RUN" \
+"7
+Error: Expression too complex in line 30"
+
+run_test "Stack high-water" \
+"10 PRINT ((1 + A) * 2)
+20 IF PEEK(253) > 0 THEN PRINT \"STACK\"
+RUN" \
+"2
+STACK"
+
 # ============================================================
 section "Edge Cases"
 # ============================================================
@@ -407,6 +784,99 @@ RUN" \
 "1
 26"
 
+run_test "Constant expressions" \
+"10 PRINT (16 * 8) + 4
+20 PRINT 7 / 0 + 32767 + 1
+30 PRINT 2 * (3 - 10)
+RUN" \
+"132
+-32761
+-14"
+
+run_test "Multiply and divide signs" \
+"10 LET A = 0 - 7
+20 LET B = 3
+30 PRINT A * B
+40 PRINT A / B
+50 PRINT A / (0 - 2)
+60 PRINT B / 0
+70 LET C = 0 - 32767 - 1
+80 PRINT C / (0 - 1)
+90 PRINT 300 * 300
+RUN" \
+"-21
+-2
+3
+3
+-32768
+24464"
+
+run_test "Division by literal constants" \
+"10 FOR I = 0 - 9 TO 9 STEP 6
+20 PRINT I / 4 + I / 3 * 100 + I / (0 - 7) * 1000
+30 NEXT I
+40 LET A = 32767
+50 PRINT A / 32767 + A / 10 + A / 1
+RUN" \
+"698
+-100
+100
+-698
+-29492"
+
+run_test "Folded literals in LIST" \
+"10 LET A = 2 + 3 * 4 - 1
+20 PRINT A * (2 - 7)
+LIST" \
+"10 LET A = 13
+20 PRINT A * (-5)"
+
+run_test "Division by a literal in LIST" \
+"10 PRINT A / 7 + B / (0 - 3) + C / 0
+20 PRINT A / 32767 / (0 - 32768)
+LIST" \
+"10 PRINT A / 7 + B / (-3) + C / 0
+20 PRINT A / 32767 / (-32768)"
+
+run_test "Keywords and operators in LIST" \
+"10 IF A<=B THEN PRINT PEEK(3) ELSE POKE 1,2
+20 LETTER=5
+LIST" \
+"10 IF A <= B THEN PRINT PEEK(3) ELSE POKE 1, 2
+20 LET TER = 5"
+
+run_test "Lines entered out of order" \
+"30 PRINT 3
+10 PRINT 1
+50 PRINT 5
+20 PRINT 2
+40 PRINT 4
+30 PRINT 33
+10
+LIST
+5 PRINT 0
+RUN" \
+"20 PRINT 2
+30 PRINT 33
+40 PRINT 4
+50 PRINT 5
+0
+2
+33
+4
+5"
+
+run_test "Statistics counters via PEEK" \
+"10 PRINT PEEK(241)
+20 PRINT PEEK(241)
+RUN
+STATS RESET
+RUN" \
+"1
+2
+1
+2"
+
 # ============================================================
 section "LIST Command"
 # ============================================================
@@ -475,6 +945,46 @@ fi
 # Clean up
 rm -f test_suite_temp.bas
 
+# 10 LET A = 300 / 20 PRINT A + 7 as SAVEd before the denser tokens
+printf '\x16\x00\x0a\x00\x08\x01\x05\x00\x0b\x06\x2c\x01\x00\x14\x00\x08\x02\x05\x00\x07\x06\x07\x00\x00' > test_suite_old.bas
+
+run_test "LOAD upgrades an old image" \
+"LOAD test_suite_old.bas
+LIST
+RUN" \
+"Loaded 17 bytes from test_suite_old.bas
+10 LET A = 300
+20 PRINT A + 7
+307"
+
+rm -f test_suite_old.bas
+
+# 10 LET A = 100 / 20 PRINT A / 7 as SAVEd before divisions were lowered
+printf '\x12\x00\x0a\x00\x01\x2a\x0b\x05\x64\x00\x14\x00\x02\x2a\x0a\x05\x07\x00\x42\x02' > test_suite_old.bas
+
+run_test "LOAD reads a version 2 image" \
+"LOAD test_suite_old.bas
+LIST
+RUN" \
+"Loaded 16 bytes from test_suite_old.bas
+10 LET A = 100
+20 PRINT A / 7
+14"
+
+rm -f test_suite_old.bas
+
+# Header promises 20 bytes but the file ends after 4
+printf '\x14\x00\x0a\x00\x01\x2a' > test_suite_short.bas
+
+run_test "Failed LOAD clears the program" \
+"10 PRINT 1
+LOAD test_suite_short.bas
+LIST
+RUN" \
+"Error loading from test_suite_short.bas"
+
+rm -f test_suite_short.bas
+
 # ============================================================
 section "Program Ordering"
 # ============================================================
@@ -497,6 +1007,85 @@ RUN" \
 Second
 Third"
 
+# ============================================================
+section "Batch Mode"
+# ============================================================
+
+run_test "INPUT twice" \
+"10 INPUT A
+20 INPUT B
+30 PRINT A + B
+RUN
+3
+4" \
+"? ? 7"
+
+run_test "INPUT into a string variable" \
+"10 INPUT \"NAME\", N\$
+20 PRINT \"HI \" + N\$
+RUN
+ADA LOVELACE" \
+"NAME? HI ADA LOVELACE"
+
+# Program file without RUN, INPUT values from a separate stream
+TOTAL=$((TOTAL + 1))
+printf "10 INPUT \"A\", A\n20 INPUT B\n30 PRINT A * B\n" > test_suite_temp.bas
+batch_output=$(printf "6\n7\n" | ./basic -f test_suite_temp.bas | tr -d '\r')
+if [ "$batch_output" == "A42" ]; then
+    echo -e "${GREEN}✓${NC} Batch run with INPUT stream"
+    PASSED=$((PASSED + 1))
+else
+    echo -e "${RED}✗${NC} Batch run with INPUT stream"
+    echo "  Output: $batch_output"
+    FAILED=$((FAILED + 1))
+fi
+rm -f test_suite_temp.bas
+
+# Same program cut into slices of one statement by the driver loop
+TOTAL=$((TOTAL + 1))
+printf "10 FOR I = 1 TO 3\n20 IF I == 2 THEN GOSUB 100 PRINT I ELSE PRINT 0\n30 NEXT I\n40 END\n100 PRINT 9\n110 RETURN\n" > test_suite_temp.bas
+batch_output=$(./basic -b 1 -f test_suite_temp.bas < /dev/null | tr -d '\r' | tr '\n' ' ')
+if [ "$batch_output" == "0 9 2 0 " ]; then
+    echo -e "${GREEN}✓${NC} Batch run one statement per step"
+    PASSED=$((PASSED + 1))
+else
+    echo -e "${RED}✗${NC} Batch run one statement per step"
+    echo "  Output: $batch_output"
+    FAILED=$((FAILED + 1))
+fi
+rm -f test_suite_temp.bas
+
+TOTAL=$((TOTAL + 1))
+printf "10 PRINT 1\n20 SLEEP 1\n30 PRINT 2\n" > test_suite_temp.bas
+batch_output=$(./basic -f test_suite_temp.bas < /dev/null | tr -d '\r' | tr '\n' ' ')
+if [ "$batch_output" == "1 2 " ]; then
+    echo -e "${GREEN}✓${NC} Batch run with SLEEP"
+    PASSED=$((PASSED + 1))
+else
+    echo -e "${RED}✗${NC} Batch run with SLEEP"
+    echo "  Output: $batch_output"
+    FAILED=$((FAILED + 1))
+fi
+rm -f test_suite_temp.bas
+
+# Several programs on a thread pool, each in its own interpreter: no
+# variables or arrays carry over, and outputs (POKE traces too) come back
+# in order
+TOTAL=$((TOTAL + 1))
+printf "10 DIM A(3)\n20 LET A(3) = 7\n30 LET X = 5\n40 PRINT A(3) * X\n" > test_suite_job1.bas
+printf "10 DIM A(3)\n15 POKE 1, 2\n20 PRINT A(3) + X\n" > test_suite_job2.bas
+printf "10 TASK 1, 100\n20 SLEEP 1\n30 PRINT X\n40 END\n100 LET X = 9\n" > test_suite_job3.bas
+batch_output=$(./basic -j 2 test_suite_job1.bas test_suite_job2.bas test_suite_job3.bas | tr -d '\r' | tr '\n' ' ')
+if [ "$batch_output" == "==> test_suite_job1.bas <== 35 ==> test_suite_job2.bas <==  POKE 0x1 <- 0x2 0 ==> test_suite_job3.bas <== 9 " ]; then
+    echo -e "${GREEN}✓${NC} Batch jobs on threads"
+    PASSED=$((PASSED + 1))
+else
+    echo -e "${RED}✗${NC} Batch jobs on threads"
+    echo "  Output: $batch_output"
+    FAILED=$((FAILED + 1))
+fi
+rm -f test_suite_job1.bas test_suite_job2.bas test_suite_job3.bas
+
 # ============================================================
 # Final Summary
 # ============================================================